@@ -0,0 +1,244 @@
+//! BGZF (blocked gzip) input.
+//!
+//! A BGZF file, as written by `bgzip`, is a series of independent gzip
+//! members of at most 64 KiB of input each, and every member header records
+//! the member's compressed size. The block boundaries of a whole file can be
+//! found by hopping from header to header without inflating anything (or read
+//! from a `.gzi` index), any range of the data located by block, and the
+//! blocks inflated in parallel.
+
+use flate2::read::GzDecoder;
+use rayon::prelude::*;
+use std::io::{Error, ErrorKind, Read};
+use std::ops::Range;
+
+/// gzip magic, deflate, and the FEXTRA flag BGZF always sets.
+const BGZF_MAGIC: [u8; 4] = [0x1f, 0x8b, 8, 4];
+
+/// Fixed gzip header up to and including XLEN.
+const FIXED_HEADER_LEN: usize = 12;
+
+/// CRC32 and ISIZE after the deflate data.
+const TRAILER_LEN: usize = 8;
+
+/// Total size of the BGZF block at the start of `data`, read from the `BC`
+/// extra subfield; `None` if `data` does not start with a BGZF block header.
+fn block_len(data: &[u8]) -> Option<usize> {
+    if data.get(..4)? != BGZF_MAGIC {
+        return None;
+    }
+    let xlen = u16::from_le_bytes([*data.get(10)?, *data.get(11)?]) as usize;
+    let extra = data.get(FIXED_HEADER_LEN..FIXED_HEADER_LEN + xlen)?;
+    let mut pos = 0;
+    while pos + 4 <= extra.len() {
+        let subfield_len = u16::from_le_bytes([extra[pos + 2], extra[pos + 3]]) as usize;
+        if &extra[pos..pos + 2] == b"BC" && subfield_len == 2 && pos + 6 <= extra.len() {
+            let len = u16::from_le_bytes([extra[pos + 4], extra[pos + 5]]) as usize + 1;
+            return (len >= FIXED_HEADER_LEN + xlen + TRAILER_LEN).then_some(len);
+        }
+        pos += 4 + subfield_len;
+    }
+    None
+}
+
+pub fn is_bgzf(data: &[u8]) -> bool {
+    block_len(data).is_some()
+}
+
+/// Byte ranges of all blocks of a BGZF file.
+pub fn block_ranges(data: &[u8]) -> Result<Vec<Range<usize>>, Error> {
+    let mut ranges = Vec::new();
+    let mut pos = 0;
+    while pos < data.len() {
+        let len = block_len(&data[pos..])
+            .filter(|&len| pos + len <= data.len())
+            .ok_or_else(|| Error::new(ErrorKind::InvalidData, format!("invalid or truncated BGZF block at byte offset {}", pos)))?;
+        ranges.push(pos..pos + len);
+        pos += len;
+    }
+    Ok(ranges)
+}
+
+/// Inflates one block into `out`, reserving its recorded size up front. The
+/// gzip decoder checks the block's CRC and length.
+pub fn inflate_block(block: &[u8], out: &mut Vec<u8>) -> Result<(), Error> {
+    out.clear();
+    out.reserve(inflated_len(block));
+    GzDecoder::new(block).read_to_end(out)?;
+    Ok(())
+}
+
+/// Uncompressed size of a block, from its ISIZE trailer field.
+fn inflated_len(block: &[u8]) -> usize {
+    let trailer = &block[block.len() - 4..];
+    u32::from_le_bytes(trailer.try_into().expect("trailer holds 4 bytes")) as usize
+}
+
+/// Where every block of a BGZF file starts, in the file and in the data it
+/// inflates to: the content of a `.gzi` index, plus the first block.
+pub struct BlockIndex {
+    /// (compressed offset, uncompressed offset) of each block, ascending.
+    starts: Vec<(u64, u64)>,
+    compressed_len: u64,
+    uncompressed_len: u64,
+}
+
+impl BlockIndex {
+    /// Builds the index of a whole file from its block headers and trailers.
+    pub fn from_blocks(data: &[u8]) -> Result<Self, Error> {
+        let mut starts = Vec::new();
+        let mut uncompressed = 0u64;
+        for range in block_ranges(data)? {
+            starts.push((range.start as u64, uncompressed));
+            uncompressed += inflated_len(&data[range]) as u64;
+        }
+        Ok(BlockIndex { starts, compressed_len: data.len() as u64, uncompressed_len: uncompressed })
+    }
+
+    /// Reads a `.gzi` index written by `bgzip -i` for the file `data`: a
+    /// little-endian count, then an offset pair for every block but the first.
+    pub fn from_gzi(gzi: &[u8], data: &[u8]) -> Result<Self, Error> {
+        let invalid = || Error::new(ErrorKind::InvalidData, "malformed .gzi index");
+        let read_u64 = |pos: usize| gzi.get(pos..pos + 8).map(|bytes| u64::from_le_bytes(bytes.try_into().expect("8 bytes")));
+        let count = read_u64(0).ok_or_else(invalid)? as usize;
+        let mut starts = vec![(0, 0)];
+        for entry in 0..count {
+            let compressed = read_u64(8 + 16 * entry).ok_or_else(invalid)?;
+            let uncompressed = read_u64(16 + 16 * entry).ok_or_else(invalid)?;
+            starts.push((compressed, uncompressed));
+        }
+        let &(last_compressed, last_uncompressed) = starts.last().expect("starts holds the first block");
+        let last_block = data.get(last_compressed as usize..).filter(|rest| is_bgzf(rest)).ok_or_else(invalid)?;
+        let last_len = block_len(last_block).expect("checked by is_bgzf");
+        if !starts.windows(2).all(|pair| pair[0] < pair[1]) || last_compressed as usize + last_len != data.len() {
+            return Err(Error::new(ErrorKind::InvalidData, ".gzi index does not match the BGZF file"));
+        }
+        let uncompressed_len = last_uncompressed + inflated_len(&last_block[..last_len]) as u64;
+        Ok(BlockIndex { starts, compressed_len: data.len() as u64, uncompressed_len })
+    }
+
+    pub fn uncompressed_len(&self) -> u64 {
+        self.uncompressed_len
+    }
+
+    fn compressed_range(&self, block: usize) -> Range<usize> {
+        let end = self.starts.get(block + 1).map_or(self.compressed_len, |&(compressed, _)| compressed);
+        self.starts[block].0 as usize..end as usize
+    }
+
+    /// Index of the block holding uncompressed offset `offset`.
+    fn block_at(&self, offset: u64) -> usize {
+        self.starts.partition_point(|&(_, uncompressed)| uncompressed <= offset).saturating_sub(1)
+    }
+}
+
+/// Passes `range` of the uncompressed data of `data` to `consume`, in order,
+/// in block-sized pieces. Blocks are inflated a batch of `batch_blocks` at a
+/// time across the pool, and each batch is consumed while the next one is
+/// inflated.
+pub fn read_range(
+    data: &[u8],
+    index: &BlockIndex,
+    range: Range<u64>,
+    batch_blocks: usize,
+    mut consume: impl FnMut(&[u8]) -> Result<(), Error> + Send,
+) -> Result<(), Error> {
+    if range.is_empty() {
+        return Ok(());
+    }
+    let blocks: Vec<usize> = (index.block_at(range.start)..=index.block_at(range.end - 1)).collect();
+    let inflate_batch = |batch: &[usize]| -> Result<Vec<(u64, Vec<u8>)>, Error> {
+        batch
+            .par_iter()
+            .map(|&block| {
+                let compressed = index.compressed_range(block);
+                let mut inflated = Vec::new();
+                inflate_block(&data[compressed.clone()], &mut inflated)
+                    .map_err(|e| Error::new(e.kind(), format!("corrupt BGZF block at byte offset {}: {}", compressed.start, e)))?;
+                Ok((index.starts[block].1, inflated))
+            })
+            .collect()
+    };
+    let mut consume_batch = |batch: &[(u64, Vec<u8>)]| -> Result<(), Error> {
+        for (start, inflated) in batch {
+            let end = start + inflated.len() as u64;
+            let piece = range.start.max(*start)..range.end.min(end);
+            if !piece.is_empty() {
+                consume(&inflated[(piece.start - start) as usize..(piece.end - start) as usize])?;
+            }
+        }
+        Ok(())
+    };
+    let mut batches = blocks.chunks(batch_blocks.max(1));
+    let mut ready = batches.next().map(inflate_batch).transpose()?.unwrap_or_default();
+    loop {
+        let next = batches.next();
+        let (consumed, inflated) = rayon::join(|| consume_batch(&ready), || next.map(inflate_batch).transpose());
+        consumed?;
+        match inflated? {
+            Some(batch) => ready = batch,
+            None => return Ok(()),
+        }
+    }
+}
+
+/// BGZF-compresses `data` in blocks of `block_input_len` bytes, followed by the
+/// standard empty end-of-file block.
+#[cfg(test)]
+pub fn compress(data: &[u8], block_input_len: usize) -> Vec<u8> {
+    use flate2::{Compression, GzBuilder};
+    use std::io::Write;
+    let mut out = Vec::new();
+    for chunk in data.chunks(block_input_len).chain(std::iter::once(&[][..])) {
+        let mut encoder = GzBuilder::new().extra(b"BC\x02\x00\x00\x00".to_vec()).write(Vec::new(), Compression::default());
+        encoder.write_all(chunk).unwrap();
+        let mut block = encoder.finish().unwrap();
+        let bsize = (block.len() - 1) as u16;
+        block[16..18].copy_from_slice(&bsize.to_le_bytes());
+        out.extend_from_slice(&block);
+    }
+    out
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_bgzf_blocks() {
+        let data: Vec<u8> = (0..200_000u32).map(|i| b"ACGTN\n"[(i * 7 % 6) as usize]).collect();
+        let compressed = compress(&data, 30_000);
+        assert!(is_bgzf(&compressed));
+        let ranges = block_ranges(&compressed).unwrap();
+        assert_eq!(ranges.len(), 8);
+        let mut inflated = Vec::new();
+        let mut block = Vec::new();
+        for range in ranges {
+            inflate_block(&compressed[range], &mut block).unwrap();
+            inflated.extend_from_slice(&block);
+        }
+        assert_eq!(inflated, data);
+
+        // Ranges through the block index, with and without a .gzi file.
+        let index = BlockIndex::from_blocks(&compressed).unwrap();
+        assert_eq!(index.uncompressed_len(), data.len() as u64);
+        let mut gzi = ((index.starts.len() - 1) as u64).to_le_bytes().to_vec();
+        for &(compressed_start, uncompressed_start) in &index.starts[1..] {
+            gzi.extend_from_slice(&compressed_start.to_le_bytes());
+            gzi.extend_from_slice(&uncompressed_start.to_le_bytes());
+        }
+        let from_gzi = BlockIndex::from_gzi(&gzi, &compressed).unwrap();
+        assert_eq!(from_gzi.starts, index.starts);
+        for range in [0..200_000u64, 29_999..30_001, 45_000..150_000, 60_000..60_000] {
+            let mut read = Vec::new();
+            read_range(&compressed, &from_gzi, range.clone(), 2, |piece| Ok(read.extend_from_slice(piece))).unwrap();
+            assert_eq!(read, &data[range.start as usize..range.end as usize]);
+        }
+
+        // Plain gzip is not BGZF, and a truncated file is an error.
+        let mut plain = flate2::write::GzEncoder::new(Vec::new(), flate2::Compression::default());
+        std::io::Write::write_all(&mut plain, &data).unwrap();
+        assert!(!is_bgzf(&plain.finish().unwrap()));
+        assert!(block_ranges(&compressed[..compressed.len() - 1]).is_err());
+    }
+}
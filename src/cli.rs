@@ -0,0 +1,210 @@
+use arrow::ipc::CompressionType;
+
+const USAGE: &str = "Usage: program [--max-distance K] [--all-tiers | --tiers LIST] [--compact | --matrix] [--parquet] [--compression lz4|zstd] [--prefetch N] [--prefetch-memory MB] <fasta_file> <output_ipc_file>";
+
+/// Waves of chromosomes loaded ahead of the one being computed, by default.
+const DEFAULT_PREFETCH_WAVES: usize = 1;
+
+/// Default memory budget, in MiB, for the packed sequence of loaded waves.
+const DEFAULT_PREFETCH_MEMORY_MB: usize = 1024;
+
+/// Number of resolution tiers (10bp, 100bp, 1kb).
+pub const NUM_TIERS: usize = 3;
+
+pub struct RunOptions {
+    pub fasta_path: String,
+    pub output_path: String,
+    /// When set, distances above K are reported as K+1 and the far tier uses the banded kernel.
+    pub max_distance: Option<u16>,
+    /// All-tiers mode: the tiers (ascending, deduplicated) to report for every
+    /// pair as separate distance columns. `None` keeps the single distance/type output.
+    pub report_tiers: Option<Vec<usize>>,
+    /// Compact output: one file per tier of runs of a row's pairs, in place of one row per pair.
+    pub compact: bool,
+    /// Dense matrix output: the distances alone, at positions given by the pair.
+    pub matrix: bool,
+    /// Parquet output in place of Arrow IPC.
+    pub parquet: bool,
+    /// Codec of the IPC body buffers, or of the Parquet pages; compressed IPC
+    /// output is written as an IPC stream.
+    pub compression: Option<CompressionType>,
+    /// Waves loaded ahead of the computation; 0 loads each one only when it is needed.
+    pub prefetch_waves: usize,
+    /// Bytes of packed sequence the current and prefetched waves may hold together.
+    pub prefetch_memory: usize,
+}
+
+pub fn parse_args<I: Iterator<Item = String>>(mut args: I) -> Result<RunOptions, String> {
+    let mut positional = Vec::new();
+    let mut max_distance = None;
+    let mut report_tiers = None;
+    let mut compact = false;
+    let mut matrix = false;
+    let mut parquet = false;
+    let mut compression = None;
+    let mut prefetch_waves = DEFAULT_PREFETCH_WAVES;
+    let mut prefetch_memory_mb = DEFAULT_PREFETCH_MEMORY_MB;
+
+    while let Some(arg) = args.next() {
+        match arg.as_str() {
+            "--max-distance" => {
+                let value = args.next().ok_or_else(|| format!("{} (missing value for --max-distance)", USAGE))?;
+                let k: u16 = value.parse().map_err(|_| format!("Invalid --max-distance '{}': expected an integer between 0 and {}", value, u16::MAX - 1))?;
+                if k == u16::MAX {
+                    return Err(format!("Invalid --max-distance '{}': expected an integer between 0 and {}", value, u16::MAX - 1));
+                }
+                max_distance = Some(k);
+            }
+            "--all-tiers" => report_tiers = Some((0..NUM_TIERS).collect()),
+            "--tiers" => {
+                let value = args.next().ok_or_else(|| format!("{} (missing value for --tiers)", USAGE))?;
+                report_tiers = Some(parse_tier_list(&value)?);
+            }
+            "--compact" => compact = true,
+            "--matrix" => matrix = true,
+            "--parquet" => parquet = true,
+            "--compression" => {
+                let value = args.next().ok_or_else(|| format!("{} (missing value for --compression)", USAGE))?;
+                compression = Some(match value.to_ascii_lowercase().as_str() {
+                    "lz4" => CompressionType::LZ4_FRAME,
+                    "zstd" => CompressionType::ZSTD,
+                    _ => return Err(format!("Invalid --compression '{}': expected lz4 or zstd", value)),
+                });
+            }
+            "--prefetch" => {
+                let value = args.next().ok_or_else(|| format!("{} (missing value for --prefetch)", USAGE))?;
+                prefetch_waves = value.parse().map_err(|_| format!("Invalid --prefetch '{}': expected a number of waves", value))?;
+            }
+            "--prefetch-memory" => {
+                let value = args.next().ok_or_else(|| format!("{} (missing value for --prefetch-memory)", USAGE))?;
+                prefetch_memory_mb = value.parse().map_err(|_| format!("Invalid --prefetch-memory '{}': expected a size in MiB", value))?;
+            }
+            _ if arg.starts_with("--") => return Err(format!("{} (unknown option '{}')", USAGE, arg)),
+            _ => positional.push(arg),
+        }
+    }
+
+    let mut positional = positional.into_iter();
+    let fasta_path = positional.next().ok_or_else(|| format!("{} (missing fasta_file)", USAGE))?;
+    let output_path = positional.next().ok_or_else(|| format!("{} (missing output_ipc_file)", USAGE))?;
+    if let Some(extra) = positional.next() {
+        return Err(format!("{} (unexpected argument '{}')", USAGE, extra));
+    }
+    if (compact || matrix) && report_tiers.is_some() {
+        return Err(format!("{} (--compact and --matrix cannot be combined with --all-tiers or --tiers)", USAGE));
+    }
+    if compact && matrix {
+        return Err(format!("{} (--compact and --matrix are separate output formats)", USAGE));
+    }
+    if matrix && (compression.is_some() || parquet) {
+        return Err(format!("{} (--parquet and --compression apply to table output, not --matrix)", USAGE));
+    }
+
+    Ok(RunOptions {
+        fasta_path,
+        output_path,
+        max_distance,
+        report_tiers,
+        compact,
+        matrix,
+        parquet,
+        compression,
+        prefetch_waves,
+        prefetch_memory: prefetch_memory_mb.saturating_mul(1 << 20),
+    })
+}
+
+/// Parses a comma-separated list of tier indices such as "0,2".
+fn parse_tier_list(value: &str) -> Result<Vec<usize>, String> {
+    let mut tiers = Vec::new();
+    for item in value.split(',') {
+        let tier: usize = item.trim().parse().map_err(|_| format!("Invalid --tiers '{}': expected comma-separated tier indices 0 to {}", value, NUM_TIERS - 1))?;
+        if tier >= NUM_TIERS {
+            return Err(format!("Invalid --tiers '{}': expected comma-separated tier indices 0 to {}", value, NUM_TIERS - 1));
+        }
+        tiers.push(tier);
+    }
+    tiers.sort_unstable();
+    tiers.dedup();
+    Ok(tiers)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn parse(args: &str) -> Result<RunOptions, String> {
+        parse_args(args.split_whitespace().map(String::from))
+    }
+
+    /// The part of a usage error after the usage line, or the whole message.
+    fn error(args: &str) -> String {
+        let message = parse(args).err().expect("arguments should be rejected");
+        message.strip_prefix(USAGE).map_or(message.clone(), |rest| rest.trim().to_string())
+    }
+
+    #[test]
+    fn test_parse_defaults_and_values() {
+        let options = parse("in.fa out.arrow").unwrap();
+        assert_eq!((options.fasta_path.as_str(), options.output_path.as_str()), ("in.fa", "out.arrow"));
+        assert_eq!(options.max_distance, None);
+        assert!(options.report_tiers.is_none() && !options.compact && !options.matrix && !options.parquet);
+        assert!(options.compression.is_none());
+        assert_eq!(options.prefetch_waves, DEFAULT_PREFETCH_WAVES);
+        assert_eq!(options.prefetch_memory, DEFAULT_PREFETCH_MEMORY_MB << 20);
+
+        let options = parse("--max-distance 0 --prefetch 0 --prefetch-memory 16 in.fa out.arrow").unwrap();
+        assert_eq!(options.max_distance, Some(0));
+        assert_eq!((options.prefetch_waves, options.prefetch_memory), (0, 16 << 20));
+        assert_eq!(parse("--max-distance 65534 --prefetch 3 in.fa out").unwrap().max_distance, Some(65534));
+        assert_eq!(parse("--prefetch 3 in.fa out").unwrap().prefetch_waves, 3);
+
+        assert_eq!(parse("--all-tiers in.fa out").unwrap().report_tiers, Some(vec![0, 1, 2]));
+        assert_eq!(parse("--tiers 2,0,2 in.fa out").unwrap().report_tiers, Some(vec![0, 2]));
+        assert_eq!(parse("--tiers 1 --max-distance 5 in.fa out").unwrap().report_tiers, Some(vec![1]));
+
+        let options = parse("--compact --parquet --compression zstd in.fa out").unwrap();
+        assert!(options.compact && options.parquet);
+        assert_eq!(options.compression, Some(CompressionType::ZSTD));
+        assert_eq!(parse("--compression LZ4 in.fa out").unwrap().compression, Some(CompressionType::LZ4_FRAME));
+        assert!(parse("--all-tiers --parquet in.fa out").unwrap().parquet);
+        let options = parse("--matrix --max-distance 100 in.fa out").unwrap();
+        assert!(options.matrix && options.max_distance == Some(100));
+    }
+
+    #[test]
+    fn test_parse_rejects_bad_values() {
+        let k_range = "expected an integer between 0 and 65534";
+        assert_eq!(error("--max-distance 65535 in.fa out"), format!("Invalid --max-distance '65535': {}", k_range));
+        assert_eq!(error("--max-distance -1 in.fa out"), format!("Invalid --max-distance '-1': {}", k_range));
+        assert_eq!(error("--max-distance x in.fa out"), format!("Invalid --max-distance 'x': {}", k_range));
+        assert_eq!(error("in.fa out --max-distance"), "(missing value for --max-distance)");
+
+        let tier_range = "expected comma-separated tier indices 0 to 2";
+        assert_eq!(error("--tiers 3 in.fa out"), format!("Invalid --tiers '3': {}", tier_range));
+        assert_eq!(error("--tiers 0,,1 in.fa out"), format!("Invalid --tiers '0,,1': {}", tier_range));
+        assert_eq!(error("--tiers a in.fa out"), format!("Invalid --tiers 'a': {}", tier_range));
+
+        assert_eq!(error("--compression gzip in.fa out"), "Invalid --compression 'gzip': expected lz4 or zstd");
+        assert_eq!(error("--prefetch -1 in.fa out"), "Invalid --prefetch '-1': expected a number of waves");
+        assert_eq!(error("--prefetch-memory lots in.fa out"), "Invalid --prefetch-memory 'lots': expected a size in MiB");
+
+        assert_eq!(error("--fast in.fa out"), "(unknown option '--fast')");
+        assert_eq!(error("in.fa"), "(missing output_ipc_file)");
+        assert_eq!(error(""), "(missing fasta_file)");
+        assert_eq!(error("in.fa out extra"), "(unexpected argument 'extra')");
+    }
+
+    #[test]
+    fn test_parse_rejects_conflicting_outputs() {
+        let tiers = "(--compact and --matrix cannot be combined with --all-tiers or --tiers)";
+        for args in ["--all-tiers --compact", "--compact --tiers 0", "--matrix --all-tiers", "--tiers 1,2 --matrix"] {
+            assert_eq!(error(&format!("{} in.fa out", args)), tiers, "{}", args);
+        }
+        assert_eq!(error("--compact --matrix in.fa out"), "(--compact and --matrix are separate output formats)");
+        let table_only = "(--parquet and --compression apply to table output, not --matrix)";
+        for args in ["--matrix --parquet", "--compression zstd --matrix", "--matrix --parquet --compression lz4"] {
+            assert_eq!(error(&format!("{} in.fa out", args)), table_only, "{}", args);
+        }
+    }
+}
@@ -0,0 +1,296 @@
+//! Exact deduplication of grid windows.
+//!
+//! The windows of one tier are grouped into classes of byte-identical sequence
+//! before any pair is computed. A pair inside one class has distance 0, a pair
+//! involving an all-`N` window has a closed form, and the remaining pairs only
+//! go through a kernel once per distinct class pair of a row (and, through
+//! `PairCache`, once across rows).
+
+use std::collections::HashMap;
+use std::hash::Hash;
+use std::ops::Range;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Mutex;
+
+/// Class shared by every window made only of `N`.
+pub const ALL_N_CLASS: u32 = 0;
+
+/// Equivalence classes of the windows of one tier, indexed by grid point.
+pub struct WindowClasses {
+    class_of: Vec<u32>,
+    multiplicity: Vec<u32>,
+}
+
+impl WindowClasses {
+    /// Classifies the `window_len`-bp window starting at every grid point.
+    pub fn new(chrom: &[u8], num_grid_points: usize, grid_spacing: usize, window_len: usize) -> Self {
+        WindowClasses::from_keys((0..num_grid_points).map(|idx| {
+            let start = idx * grid_spacing;
+            let window = &chrom[start..start + window_len];
+            (!window.iter().all(|&b| b == b'N')).then_some(window)
+        }))
+    }
+
+    /// Classifies windows given as keys that are equal exactly when the
+    /// windows are, in grid order; `None` marks an all-`N` window.
+    pub fn from_keys<K: Hash + Eq>(keys: impl Iterator<Item = Option<K>>) -> Self {
+        let mut class_of = Vec::with_capacity(keys.size_hint().0);
+        let mut multiplicity = vec![0u32];
+        let mut class_by_key: HashMap<K, u32> = HashMap::new();
+        for key in keys {
+            let class = match key {
+                None => ALL_N_CLASS,
+                Some(key) => {
+                    let next_class = multiplicity.len() as u32;
+                    *class_by_key.entry(key).or_insert_with(|| {
+                        multiplicity.push(0);
+                        next_class
+                    })
+                }
+            };
+            multiplicity[class as usize] += 1;
+            class_of.push(class);
+        }
+        WindowClasses { class_of, multiplicity }
+    }
+
+    #[inline]
+    pub fn class(&self, idx: usize) -> u32 {
+        self.class_of[idx]
+    }
+
+    /// Number of classes, including the (possibly empty) all-`N` class.
+    pub fn num_classes(&self) -> usize {
+        self.multiplicity.len()
+    }
+
+    /// Number of distinct windows that contain at least one non-`N` base.
+    pub fn num_sequence_classes(&self) -> usize {
+        self.multiplicity.len() - 1
+    }
+
+    pub fn num_all_n_windows(&self) -> usize {
+        self.multiplicity[ALL_N_CLASS as usize] as usize
+    }
+
+    /// Whether more than one window belongs to `class`, i.e. whether a pair
+    /// involving it can come up again.
+    #[inline]
+    pub fn is_repeated(&self, class: u32) -> bool {
+        self.multiplicity[class as usize] > 1
+    }
+}
+
+/// Distance between an all-`N` window and `other` of the same length: only the
+/// `N`s of `other` can be matched, and substituting every other base is optimal.
+pub fn all_n_distance(other: &[u8]) -> u16 {
+    other.iter().filter(|&&b| b != b'N').count() as u16
+}
+
+/// Where the distance of one pair of a planned row segment comes from.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum PairSource {
+    /// Both windows are in the same class.
+    Identical,
+    /// Exactly one of the windows is all `N`; see `all_n_distance`.
+    AllN,
+    /// Found in the shared `PairCache`.
+    Cached(u16),
+    /// Computed once for the representative at this index of the plan.
+    Representative(u32),
+}
+
+/// Per-worker scratch that resolves a row segment into the distinct class pairs
+/// that still need a kernel. Class stamps are tagged with a generation counter,
+/// so the scratch is never cleared between rows.
+#[derive(Default)]
+pub struct RowPlanner {
+    generation: u32,
+    stamps: Vec<u32>,
+    slots: Vec<u32>,
+    query_class: u32,
+    idx2_start: usize,
+    /// Grid points whose distance to the query must be computed, one per class.
+    pub representatives: Vec<usize>,
+    /// One entry per grid point of the planned range, in idx2 order.
+    pub sources: Vec<PairSource>,
+}
+
+impl RowPlanner {
+    /// Plans the pairs between grid point `idx1` and every grid point of
+    /// `idx2_range`. `cache` is only consulted for pairs that can recur.
+    pub fn plan(&mut self, classes: &WindowClasses, idx1: usize, idx2_range: Range<usize>, cache: Option<&PairCache>) {
+        self.representatives.clear();
+        self.sources.clear();
+        if self.stamps.len() < classes.num_classes() {
+            self.stamps.resize(classes.num_classes(), 0);
+            self.slots.resize(classes.num_classes(), 0);
+        }
+        self.generation = self.generation.wrapping_add(1);
+        if self.generation == 0 {
+            self.stamps.fill(0);
+            self.generation = 1;
+        }
+
+        let query_class = classes.class(idx1);
+        let query_repeated = classes.is_repeated(query_class);
+        self.query_class = query_class;
+        self.idx2_start = idx2_range.start;
+        for idx2 in idx2_range {
+            let class = classes.class(idx2);
+            let source = if class == query_class {
+                PairSource::Identical
+            } else if query_class == ALL_N_CLASS || class == ALL_N_CLASS {
+                PairSource::AllN
+            } else if self.stamps[class as usize] == self.generation {
+                PairSource::Representative(self.slots[class as usize])
+            } else {
+                let cached = match cache {
+                    Some(cache) if query_repeated || classes.is_repeated(class) => cache.get(query_class, class),
+                    _ => None,
+                };
+                match cached {
+                    Some(dist) => PairSource::Cached(dist),
+                    None => {
+                        let slot = self.representatives.len() as u32;
+                        self.stamps[class as usize] = self.generation;
+                        self.slots[class as usize] = slot;
+                        self.representatives.push(idx2);
+                        PairSource::Representative(slot)
+                    }
+                }
+            };
+            self.sources.push(source);
+        }
+    }
+
+    /// Records the distances computed for the representatives in `cache`,
+    /// skipping pairs that cannot come up again.
+    pub fn remember(&self, classes: &WindowClasses, representative_distances: &[u16], cache: &PairCache) {
+        let query_repeated = classes.is_repeated(self.query_class);
+        for (&idx2, &dist) in self.representatives.iter().zip(representative_distances) {
+            let class = classes.class(idx2);
+            if query_repeated || classes.is_repeated(class) {
+                cache.insert(self.query_class, class, dist);
+            }
+        }
+    }
+
+    /// Appends one distance per planned pair to `out`. `all_n` gives the
+    /// distance of an `AllN` pair from its idx2.
+    pub fn fan_out(&self, representative_distances: &[u16], all_n: impl Fn(usize) -> u16, out: &mut Vec<u16>) {
+        out.extend(self.sources.iter().enumerate().map(|(offset, source)| match *source {
+            PairSource::Identical => 0,
+            PairSource::AllN => all_n(self.idx2_start + offset),
+            PairSource::Cached(dist) => dist,
+            PairSource::Representative(slot) => representative_distances[slot as usize],
+        }));
+    }
+}
+
+const PAIR_CACHE_SHARD_BITS: u32 = 6;
+
+/// Distances of class pairs shared by all workers of one tier, sharded to keep
+/// lock contention low. Inserts stop once `capacity` entries are stored.
+pub struct PairCache {
+    shards: Vec<Mutex<HashMap<u64, u16>>>,
+    len: AtomicUsize,
+    capacity: usize,
+}
+
+impl PairCache {
+    pub fn new(capacity: usize) -> Self {
+        PairCache {
+            shards: (0..1 << PAIR_CACHE_SHARD_BITS).map(|_| Mutex::new(HashMap::new())).collect(),
+            len: AtomicUsize::new(0),
+            capacity,
+        }
+    }
+
+    /// Edit distance is symmetric, so both orders of a pair share one key.
+    fn key(class1: u32, class2: u32) -> u64 {
+        let (lo, hi) = if class1 < class2 { (class1, class2) } else { (class2, class1) };
+        ((lo as u64) << 32) | hi as u64
+    }
+
+    fn shard(&self, key: u64) -> &Mutex<HashMap<u64, u16>> {
+        let hash = key.wrapping_mul(0x9E37_79B9_7F4A_7C15) >> (u64::BITS - PAIR_CACHE_SHARD_BITS);
+        &self.shards[hash as usize]
+    }
+
+    pub fn get(&self, class1: u32, class2: u32) -> Option<u16> {
+        let key = Self::key(class1, class2);
+        self.shard(key).lock().expect("pair cache lock poisoned").get(&key).copied()
+    }
+
+    pub fn insert(&self, class1: u32, class2: u32, dist: u16) {
+        if self.len.load(Ordering::Relaxed) >= self.capacity {
+            return;
+        }
+        let key = Self::key(class1, class2);
+        if self.shard(key).lock().expect("pair cache lock poisoned").insert(key, dist).is_none() {
+            self.len.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+
+    pub fn len(&self) -> usize {
+        self.len.load(Ordering::Relaxed)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_window_classes() {
+        // Grid of 4bp windows: ACGT, NNNN, ACGT, NNAN, NNNN, TTTT.
+        let chrom = b"ACGTNNNNACGTNNANNNNNTTTT";
+        let classes = WindowClasses::new(chrom, 6, 4, 4);
+        assert_eq!(classes.class(1), ALL_N_CLASS);
+        assert_eq!(classes.class(4), ALL_N_CLASS);
+        assert_eq!(classes.class(0), classes.class(2));
+        assert_ne!(classes.class(3), ALL_N_CLASS);
+        assert_ne!(classes.class(0), classes.class(5));
+        assert_eq!(classes.num_sequence_classes(), 3);
+        assert_eq!(classes.num_all_n_windows(), 2);
+        assert!(classes.is_repeated(classes.class(0)));
+        assert!(!classes.is_repeated(classes.class(5)));
+    }
+
+    #[test]
+    fn test_all_n_distance() {
+        assert_eq!(all_n_distance(b"NNNN"), 0);
+        assert_eq!(all_n_distance(b"ANNC"), 2);
+        assert_eq!(all_n_distance(b"ACGT"), 4);
+    }
+
+    #[test]
+    fn test_row_planner_fan_out() {
+        // Windows: ACGT, TTTT, ACGT, TTTT, NNNN, GGGG.
+        let chrom = b"ACGTTTTTACGTTTTTNNNNGGGG";
+        let classes = WindowClasses::new(chrom, 6, 4, 4);
+        let cache = PairCache::new(16);
+        let mut planner = RowPlanner::default();
+        planner.plan(&classes, 0, 1..6, Some(&cache));
+        assert_eq!(planner.representatives, vec![1, 5]);
+        assert_eq!(planner.sources, vec![
+            PairSource::Representative(0),
+            PairSource::Identical,
+            PairSource::Representative(0),
+            PairSource::AllN,
+            PairSource::Representative(1),
+        ]);
+
+        let mut out = Vec::new();
+        // The query is not a gap, so the all-N pair takes its distance from the query window.
+        planner.fan_out(&[3, 4], |_| all_n_distance(&chrom[0..4]), &mut out);
+        assert_eq!(out, vec![3, 0, 3, 4, 4]);
+
+        planner.remember(&classes, &[3, 4], &cache);
+        assert_eq!(cache.len(), 2);
+        planner.plan(&classes, 2, 3..4, Some(&cache));
+        assert!(planner.representatives.is_empty());
+        assert_eq!(planner.sources, vec![PairSource::Cached(3)]);
+    }
+}
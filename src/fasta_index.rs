@@ -0,0 +1,315 @@
+//! Indexed, on-demand access to the chromosomes of a FASTA file.
+//!
+//! Chromosomes are read only when the computation reaches them and dropped
+//! once their pairs are written, so a run holds a wave of chromosomes in
+//! memory rather than the whole genome. Where each chromosome's sequence lines
+//! are comes from the samtools `.fai` index next to the FASTA when there is
+//! one, and from a first pass over the file otherwise. BGZF files are located
+//! by block through their `.gzi` index, or through the block headers. Inputs
+//! that can only be read front to back (standard input, pipes, plain gzip) are
+//! loaded whole instead.
+
+use crate::bgzf;
+use crate::fasta_parser::{self, FastaParser};
+use crate::genome::{Contig, Genome};
+use crate::packed::PackedSequence;
+use crate::twobit::TwoBitFile;
+use memmap2::Mmap;
+use std::fs::File;
+use std::io::{Error, ErrorKind};
+use std::ops::Range;
+use std::path::Path;
+use std::sync::Arc;
+
+/// A contig located in the (uncompressed) FASTA.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct IndexedContig {
+    pub name: String,
+    /// Number of residues. A samtools index counts every one, while only `ACGTN`
+    /// are loaded, so this is an upper bound on the bases the contig holds.
+    pub len: usize,
+    /// Byte range of its sequence lines.
+    pub lines: Range<u64>,
+}
+
+/// Parses a `.fai` index: NAME, LENGTH, OFFSET, LINEBASES and LINEWIDTH per line.
+fn parse_fai(text: &str) -> Result<Vec<IndexedContig>, String> {
+    let mut contigs = Vec::new();
+    for (line_number, line) in text.lines().enumerate().filter(|(_, line)| !line.trim().is_empty()) {
+        let fields: Vec<&str> = line.split('\t').collect();
+        let number = |field: usize| -> Result<u64, String> {
+            fields.get(field).and_then(|value| value.trim().parse().ok())
+                .ok_or_else(|| format!("malformed line {}: '{}'", line_number + 1, line))
+        };
+        let (len, offset, line_bases, line_width) = (number(1)?, number(2)?, number(3)?, number(4)?);
+        if len > 0 && (line_bases == 0 || line_width < line_bases) {
+            return Err(format!("malformed line {}: '{}'", line_number + 1, line));
+        }
+        // Full lines with their line ends, then the bases of the last partial line.
+        let lines_len = if len == 0 { 0 } else { len / line_bases * line_width + len % line_bases };
+        contigs.push(IndexedContig { name: fields[0].to_string(), len: len as usize, lines: offset..offset + lines_len });
+    }
+    Ok(contigs)
+}
+
+/// A memory-mapped FASTA or BGZF file and the location of every contig in it.
+pub struct IndexedFasta {
+    path: String,
+    data: Mmap,
+    /// Block index when the file is BGZF-compressed.
+    blocks: Option<bgzf::BlockIndex>,
+    contigs: Vec<IndexedContig>,
+}
+
+impl IndexedFasta {
+    fn open(path: &str, data: Mmap) -> Result<Self, Error> {
+        let blocks = if path.ends_with(".gz") {
+            println!("'{}' is BGZF-compressed, reading it block by block.", path);
+            let gzi_path = format!("{}.gzi", path);
+            Some(if Path::new(&gzi_path).exists() {
+                println!("Reading BGZF block index '{}'.", gzi_path);
+                let gzi = std::fs::read(&gzi_path)?;
+                bgzf::BlockIndex::from_gzi(&gzi, &data)
+                    .map_err(|e| Error::new(e.kind(), format!("Invalid index '{}': {}", gzi_path, e)))?
+            } else {
+                bgzf::BlockIndex::from_blocks(&data)
+                    .map_err(|e| Error::new(e.kind(), format!("Error reading BGZF file '{}': {}", path, e)))?
+            })
+        } else {
+            None
+        };
+        let data_len = blocks.as_ref().map_or(data.len() as u64, |blocks| blocks.uncompressed_len());
+
+        let fai_path = format!("{}.fai", path);
+        let contigs = if Path::new(&fai_path).exists() {
+            println!("Reading FASTA index '{}'.", fai_path);
+            let text = std::fs::read_to_string(&fai_path)?;
+            let contigs = parse_fai(&text).map_err(|e| Error::new(ErrorKind::InvalidData, format!("Invalid index '{}': {}", fai_path, e)))?;
+            if contigs.iter().any(|contig| contig.lines.end > data_len) {
+                return Err(Error::new(ErrorKind::InvalidData, format!("Index '{}' does not match '{}'; re-create it with `samtools faidx`.", fai_path, path)));
+            }
+            contigs.into_iter().filter(|contig| {
+                if contig.len == 0 {
+                    eprintln!("Warning: Chromosome/sequence entry '{}' in file '{}' had no sequence data. Skipping.", contig.name, path);
+                }
+                contig.len > 0
+            }).collect()
+        } else {
+            println!("No index '{}' found, indexing '{}' in a first pass.", fai_path, path);
+            let mut indexer = FastaParser::indexer(path);
+            match &blocks {
+                Some(blocks) => indexer.feed_bgzf_range(&data, blocks, 0..data_len)?,
+                None => indexer.feed(&data)?,
+            }
+            indexer.finish_index()?
+        };
+        Ok(IndexedFasta { path: path.to_string(), data, blocks, contigs })
+    }
+
+    /// Reads `contigs` into one arena, checking them against the index. Returns
+    /// it with the position in `contigs` of each contig it holds: one without
+    /// any `ACGTN` base loads empty and is left out.
+    fn load(&self, contigs: &[IndexedContig]) -> Result<(Genome, Vec<usize>), Error> {
+        let mut parser = FastaParser::new(&self.path);
+        for contig in contigs {
+            parser.begin_indexed_contig(contig.name.clone());
+            match &self.blocks {
+                Some(blocks) => parser.feed_bgzf_range(&self.data, blocks, contig.lines.clone())?,
+                None => parser.feed(&self.data[contig.lines.start as usize..contig.lines.end as usize])?,
+            }
+        }
+        let genome = parser.finish()?;
+        // Other IUPAC codes are dropped on load, so a contig may be shorter than its index entry, never longer.
+        let mut positions = Vec::with_capacity(genome.contigs().len());
+        let mut indexed = contigs.iter().enumerate();
+        for loaded in genome.contigs() {
+            match indexed.by_ref().find(|(_, contig)| contig.name == loaded.name) {
+                Some((position, contig)) if loaded.range.len() <= contig.len => positions.push(position),
+                _ => return Err(Error::new(ErrorKind::InvalidData, format!("Sequence lengths in '{}' do not match its index; re-create the index.", self.path))),
+            }
+        }
+        for (position, contig) in contigs.iter().enumerate() {
+            if positions.binary_search(&position).is_err() {
+                eprintln!("Warning: Chromosome/sequence entry '{}' in file '{}' had no sequence data. Skipping.", contig.name, self.path);
+            }
+        }
+        Ok((genome, positions))
+    }
+}
+
+/// Chromosomes of one wave, sharing one arena.
+pub struct Wave {
+    pub sequence: Arc<PackedSequence>,
+    pub contigs: Vec<Contig>,
+    /// Position of each of `contigs` among all chromosomes of the source.
+    pub inputs: Vec<usize>,
+}
+
+/// Where the chromosomes of a run come from.
+pub enum ChromosomeSource {
+    /// Read on demand, a wave at a time.
+    Indexed(IndexedFasta),
+    /// A `.2bit` file, read on demand like an indexed FASTA.
+    TwoBit(TwoBitFile),
+    /// Loaded whole up front.
+    Loaded { sequence: Arc<PackedSequence>, contigs: Vec<Contig> },
+}
+
+impl ChromosomeSource {
+    /// Indexes `path` for on-demand loading when it is a regular (plain or
+    /// BGZF) file or a `.2bit` file, and loads it whole otherwise.
+    pub fn open(path: &str) -> Result<Self, Error> {
+        if path.ends_with(".2bit") {
+            return TwoBitFile::open(path).map(ChromosomeSource::TwoBit);
+        }
+        if path != "-" {
+            let file = File::open(path)
+                .map_err(|e| Error::new(e.kind(), format!("Failed to open FASTA file '{}': {}", path, e)))?;
+            if file.metadata()?.is_file() {
+                let data = fasta_parser::map_file(&file, path)?;
+                if !path.ends_with(".gz") || bgzf::is_bgzf(&data) {
+                    return IndexedFasta::open(path, data).map(ChromosomeSource::Indexed);
+                }
+            }
+        }
+        let (sequence, contigs) = fasta_parser::load_chromosomes(path)?.into_parts();
+        Ok(ChromosomeSource::Loaded { sequence, contigs })
+    }
+
+    pub fn len(&self) -> usize {
+        match self {
+            ChromosomeSource::Indexed(fasta) => fasta.contigs.len(),
+            ChromosomeSource::TwoBit(twobit) => twobit.records().len(),
+            ChromosomeSource::Loaded { contigs, .. } => contigs.len(),
+        }
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Names of all chromosomes, in file order.
+    pub fn names(&self) -> Vec<&str> {
+        match self {
+            ChromosomeSource::Indexed(fasta) => fasta.contigs.iter().map(|contig| contig.name.as_str()).collect(),
+            ChromosomeSource::TwoBit(twobit) => twobit.records().iter().map(|record| record.name.as_str()).collect(),
+            ChromosomeSource::Loaded { contigs, .. } => contigs.iter().map(|contig| contig.name.as_str()).collect(),
+        }
+    }
+
+    /// The chromosomes in file order, grouped into waves of at most
+    /// `wave_bases` bases (a longer chromosome is a wave on its own).
+    pub fn plan_waves(&self, wave_bases: usize) -> Vec<Range<usize>> {
+        wave_ranges(&self.lens(), wave_bases)
+    }
+
+    /// Lengths of all chromosomes, in file order. For a FASTA index these count
+    /// every residue, so they bound the lengths loaded rather than give them.
+    pub fn lens(&self) -> Vec<usize> {
+        match self {
+            ChromosomeSource::Indexed(fasta) => fasta.contigs.iter().map(|contig| contig.len).collect(),
+            ChromosomeSource::TwoBit(twobit) => twobit.records().iter().map(|record| record.len).collect(),
+            ChromosomeSource::Loaded { contigs, .. } => contigs.iter().map(|contig| contig.range.len()).collect(),
+        }
+    }
+
+    /// Memory the packed sequence of a wave takes once loaded; nothing for
+    /// a source that is already in memory.
+    pub fn wave_bytes(&self, wave: Range<usize>) -> usize {
+        match self {
+            ChromosomeSource::Indexed(fasta) => fasta.contigs[wave].iter().map(|contig| contig.len.div_ceil(32) * 8).sum(),
+            ChromosomeSource::TwoBit(twobit) => twobit.records()[wave].iter().map(|record| record.len.div_ceil(32) * 8).sum(),
+            ChromosomeSource::Loaded { .. } => 0,
+        }
+    }
+
+    /// The chromosomes of a wave, read from the file if the source is indexed.
+    pub fn load_wave(&self, wave: Range<usize>) -> Result<Wave, Error> {
+        let first = wave.start;
+        match self {
+            ChromosomeSource::Indexed(fasta) => {
+                let (genome, positions) = fasta.load(&fasta.contigs[wave])?;
+                let (sequence, contigs) = genome.into_parts();
+                Ok(Wave { sequence, contigs, inputs: positions.into_iter().map(|position| first + position).collect() })
+            }
+            ChromosomeSource::TwoBit(twobit) => {
+                let (sequence, contigs) = twobit.load(twobit.records()[wave.clone()].iter().map(|record| record.name.as_str()))?.into_parts();
+                Ok(Wave { sequence, contigs, inputs: wave.collect() })
+            }
+            ChromosomeSource::Loaded { sequence, contigs } => {
+                Ok(Wave { sequence: sequence.clone(), contigs: contigs[wave.clone()].to_vec(), inputs: wave.collect() })
+            }
+        }
+    }
+}
+
+/// Splits consecutive items of the given sizes into groups of at most
+/// `max_total`, or single items larger than that.
+fn wave_ranges(lens: &[usize], max_total: usize) -> Vec<Range<usize>> {
+    let mut ranges = Vec::new();
+    let mut start = 0;
+    let mut total = 0;
+    for (i, &len) in lens.iter().enumerate() {
+        if i > start && total + len > max_total {
+            ranges.push(start..i);
+            start = i;
+            total = 0;
+        }
+        total += len;
+    }
+    if start < lens.len() {
+        ranges.push(start..lens.len());
+    }
+    ranges
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_fai_and_first_pass_index_agree() {
+        // Lines of 7 bases plus "\n", and one entry with Windows line ends.
+        let fasta = b">chr1 desc\nACGTACG\nTTNNA\n>chr2\nAAAAAAA\nCCCCCCC\n>win\r\nACG\r\nT\r\n";
+        let fai = "chr1\t12\t11\t7\t8\nchr2\t14\t31\t7\t8\nwin\t4\t53\t3\t5\n";
+        let from_fai = parse_fai(fai).unwrap();
+        let mut indexer = FastaParser::indexer("test.fa");
+        indexer.feed(fasta).unwrap();
+        let from_pass = indexer.finish_index().unwrap();
+        assert_eq!(from_fai.len(), 3);
+        for (a, b) in from_fai.iter().zip(&from_pass) {
+            assert_eq!((&a.name, a.len, a.lines.start), (&b.name, b.len, b.lines.start));
+            // The .fai range ends after the last full line or base, the first pass at the next header.
+            let lines = |range: &Range<u64>| fasta[range.start as usize..range.end as usize].trim_ascii_end();
+            assert_eq!(lines(&a.lines), lines(&b.lines));
+        }
+        assert!(parse_fai("chr1\t12\tx\t7\t8\n").is_err());
+    }
+
+    #[test]
+    fn test_index_lengths_bound_loaded_lengths() {
+        // samtools counts every residue, and the IUPAC codes other than N are dropped on load.
+        let fasta = b">chr1\nACGRTAC\nYYNNA\n>iupac\nRYKM\n>chr2\nACGTACG\nT\n";
+        let fai = "chr1\t12\t6\t7\t8\niupac\t4\t27\t4\t5\nchr2\t8\t38\t7\t8\n";
+        let path = std::env::temp_dir().join(format!("levx-fai-test-{}.fa", std::process::id()));
+        let path = path.to_str().unwrap();
+        std::fs::write(path, fasta).unwrap();
+        std::fs::write(format!("{}.fai", path), fai).unwrap();
+        let source = ChromosomeSource::open(path).unwrap();
+        let wave = source.load_wave(0..source.len());
+        std::fs::remove_file(path).unwrap();
+        std::fs::remove_file(format!("{}.fai", path)).unwrap();
+
+        assert_eq!(source.lens(), vec![12, 4, 8]);
+        let wave = wave.unwrap();
+        let loaded: Vec<(&str, usize)> = wave.contigs.iter().map(|contig| (contig.name.as_str(), contig.range.len())).collect();
+        assert_eq!(loaded, vec![("chr1", 9), ("chr2", 8)]);
+        assert_eq!(wave.inputs, vec![0, 2]);
+    }
+
+    #[test]
+    fn test_wave_ranges() {
+        assert_eq!(wave_ranges(&[5, 5, 20, 3, 3, 3, 9], 10), vec![0..2, 2..3, 3..6, 6..7]);
+        assert!(wave_ranges(&[], 10).is_empty());
+    }
+}
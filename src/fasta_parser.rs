@@ -1,63 +1,489 @@
-use flate2::read::GzDecoder;
+//! FASTA loading.
+//!
+//! Regular files are memory-mapped and parsed in place (see `fasta_index`);
+//! BGZF blocks are inflated in parallel; plain gzip is inflated on a separate
+//! thread a few chunks ahead of parsing; anything else (stdin, pipes) is read
+//! in large chunks. Every source feeds the same incremental parser. The
+//! parser classifies 64 bytes at a time into newline, '>' and `ACGTN`
+//! bitmasks, gathers the bases into a small fixed buffer and packs them into
+//! the 2-bit store a word at a time: no line is ever allocated, trimmed or
+//! uppercased on its own.
+
+use crate::bgzf;
+use crate::fasta_index::IndexedContig;
+use crate::genome::Genome;
+use crate::levenshtein::{simd_level, SimdLevel};
+use crossbeam_channel::bounded;
+use flate2::read::MultiGzDecoder;
+use memmap2::Mmap;
 use std::fs::File;
-// Removed unused std::io::Read
-use std::io::{BufRead, BufReader, Error, ErrorKind}; 
-
-const APPROX_CHROMOSOME_CAPACITY: usize = 100 * 1024 * 1024;
-
-pub fn load_chromosomes(path: &str) -> Result<Vec<(String, Vec<u8>)>, Error> {
-    let file = File::open(path)
-        .map_err(|e| Error::new(e.kind(), format!("Failed to open FASTA file '{}': {}", path, e)))?;
-    
-    let reader: Box<dyn BufRead> = if path.ends_with(".gz") {
-        println!("Detected .gz extension for '{}', reading as gzipped FASTA.", path);
-        Box::new(BufReader::new(GzDecoder::new(file)))
+use std::io::{Error, ErrorKind, Read};
+use std::ops::Range;
+use std::thread;
+
+/// Bytes classified per step, one bit each in a `u64` mask.
+const BLOCK_LEN: usize = 64;
+
+/// Bases gathered from the input before they are packed in one go.
+const STAGED_BASES: usize = 1 << 14;
+
+/// Read size of the streaming path.
+const STREAM_CHUNK_LEN: usize = 1 << 20;
+
+/// BGZF blocks inflated per parallel batch: 16 MiB of FASTA at most, while
+/// the previous batch is parsed.
+const BGZF_BATCH_BLOCKS: usize = 256;
+
+/// Decompressed chunks a plain gzip stream may run ahead of the parser.
+const GZIP_PIPELINE_DEPTH: usize = 4;
+
+/// Loads every sequence of a FASTA file that can only be read front to back
+/// (standard input as `-`, a pipe, or gzip) into one packed contig arena.
+/// Regular files are read through `fasta_index` instead.
+pub fn load_chromosomes(path: &str) -> Result<Genome, Error> {
+    let mut parser = FastaParser::new(path);
+    if path == "-" {
+        println!("Reading FASTA from standard input.");
+        parser.feed_stream(std::io::stdin().lock())?;
     } else {
-        Box::new(BufReader::new(file))
+        let file = File::open(path)
+            .map_err(|e| Error::new(e.kind(), format!("Failed to open FASTA file '{}': {}", path, e)))?;
+        if path.ends_with(".gz") {
+            println!("Detected .gz extension for '{}', reading as gzipped FASTA.", path);
+            parser.feed_gzip_pipelined(file)?;
+        } else {
+            parser.feed_stream(file)?;
+        }
+    }
+    let genome = parser.finish()?;
+
+    if genome.is_empty() && (path.ends_with(".fa") || path.ends_with(".fasta") || path.ends_with(".fa.gz") || path.ends_with(".fasta.gz")) {
+         println!("Warning: No valid chromosome sequences found in '{}'. Output will be empty if this was the only input.", path);
+    }
+    Ok(genome)
+}
+
+/// Maps a regular file read-only.
+pub fn map_file(file: &File, path: &str) -> Result<Mmap, Error> {
+    // SAFETY: the mapping is read-only; the input must not be truncated while
+    // the run is using it.
+    unsafe { Mmap::map(file) }
+        .map_err(|e| Error::new(e.kind(), format!("Failed to map FASTA file '{}': {}", path, e)))
+}
+
+/// Newline, '>' and `ACGTN` flags of one block, bit i for byte i.
+struct BlockMasks {
+    newlines: u64,
+    headers: u64,
+    bases: u64,
+}
+
+/// Mask with the low `n` bits set, for `n` up to 64.
+#[inline]
+fn low_bits(n: usize) -> u64 {
+    if n >= 64 { !0 } else { (1u64 << n) - 1 }
+}
+
+/// Classifies the bytes of a block one at a time; the reference for the
+/// vector versions below.
+#[cfg_attr(target_arch = "x86_64", allow(dead_code))]
+fn classify_block_portable(block: &[u8; BLOCK_LEN]) -> BlockMasks {
+    let mut masks = BlockMasks { newlines: 0, headers: 0, bases: 0 };
+    for (i, &byte) in block.iter().enumerate() {
+        // Clearing bit 5 uppercases letters, and only maps a byte onto one of
+        // A, C, G, T or N if it was that letter in either case.
+        let up = byte & !0x20;
+        let is_base = matches!(up, b'A' | b'C' | b'G' | b'T' | b'N');
+        masks.newlines |= ((byte == b'\n') as u64) << i;
+        masks.headers |= ((byte == b'>') as u64) << i;
+        masks.bases |= (is_base as u64) << i;
+    }
+    masks
+}
+
+/// `classify_block_portable` with one byte comparison per lane and a
+/// movemask per flag, `$lanes` bytes at a time.
+macro_rules! classify_block_for_isa {
+    ($name:ident, $feature:literal, $vector:ty, $lanes:literal, $load:ident, $splat:ident, $cmpeq:ident, $and:ident, $or:ident, $movemask:ident) => {
+        #[cfg(target_arch = "x86_64")]
+        #[target_feature(enable = $feature)]
+        unsafe fn $name(block: &[u8; BLOCK_LEN]) -> BlockMasks {
+            use std::arch::x86_64::*;
+            let mut masks = BlockMasks { newlines: 0, headers: 0, bases: 0 };
+            for step in 0..BLOCK_LEN / $lanes {
+                let bytes = $load(block.as_ptr().add(step * $lanes) as *const $vector);
+                let up = $and(bytes, $splat(!0x20u8 as i8));
+                let is_base = $or(
+                    $or($cmpeq(up, $splat(b'A' as i8)), $cmpeq(up, $splat(b'C' as i8))),
+                    $or($or($cmpeq(up, $splat(b'G' as i8)), $cmpeq(up, $splat(b'T' as i8))), $cmpeq(up, $splat(b'N' as i8))),
+                );
+                let shift = step * $lanes;
+                masks.newlines |= ($movemask($cmpeq(bytes, $splat(b'\n' as i8))) as u32 as u64) << shift;
+                masks.headers |= ($movemask($cmpeq(bytes, $splat(b'>' as i8))) as u32 as u64) << shift;
+                masks.bases |= ($movemask(is_base) as u32 as u64) << shift;
+            }
+            masks
+        }
     };
+}
+
+classify_block_for_isa!(classify_block_sse2, "sse2", __m128i, 16,
+    _mm_loadu_si128, _mm_set1_epi8, _mm_cmpeq_epi8, _mm_and_si128, _mm_or_si128, _mm_movemask_epi8);
+classify_block_for_isa!(classify_block_avx2, "avx2", __m256i, 32,
+    _mm256_loadu_si256, _mm256_set1_epi8, _mm256_cmpeq_epi8, _mm256_and_si256, _mm256_or_si256, _mm256_movemask_epi8);
 
-    let mut chromosomes = Vec::new();
-    let mut current_sequence = Vec::new();
-    let mut current_header_name: Option<String> = None;
-
-    for line_result in reader.lines() {
-        let line = line_result.map_err(|e| Error::new(e.kind(), format!("Error reading line from FASTA file '{}': {}", path, e)))?;
-        
-        if line.starts_with('>') {
-            if let Some(header_name) = current_header_name.take() {
-                if !current_sequence.is_empty() {
-                    chromosomes.push((header_name, std::mem::take(&mut current_sequence)));
-                } else {
-                    eprintln!("Warning: Chromosome/sequence entry '{}' in file '{}' had no sequence data. Skipping.", header_name, path);
+/// SSE2 is part of x86_64 itself, so only AVX2 needs the runtime check.
+fn classify_block(level: SimdLevel, block: &[u8; BLOCK_LEN]) -> BlockMasks {
+    match level {
+        // SAFETY: `level` comes from `simd_level`, which checked AVX2 support.
+        #[cfg(target_arch = "x86_64")]
+        SimdLevel::Avx2 | SimdLevel::Avx512 => unsafe { classify_block_avx2(block) },
+        // SAFETY: every x86_64 CPU has SSE2.
+        #[cfg(target_arch = "x86_64")]
+        _ => unsafe { classify_block_sse2(block) },
+        #[cfg(not(target_arch = "x86_64"))]
+        _ => classify_block_portable(block),
+    }
+}
+
+/// Incremental FASTA parser; the input may arrive in pieces of any size. It
+/// either packs the bases it reads, or, as an indexer, only counts them and
+/// records where each contig's sequence lines are.
+pub struct FastaParser<'a> {
+    path: &'a str,
+    level: SimdLevel,
+    genome: Genome,
+    /// Bases of the open contig not yet packed. Lines are short, so runs are
+    /// gathered here to be packed a full storage word at a time.
+    staged: Vec<u8>,
+    /// Indexer only: the contigs found so far, and the open one with the
+    /// bases counted in it.
+    index: Option<Vec<IndexedContig>>,
+    open_record: Option<IndexedContig>,
+    /// The header line read so far, while inside one, and the offset of its '>'.
+    header: Option<Vec<u8>>,
+    header_start: u64,
+    /// Bytes fed so far.
+    offset: u64,
+    /// Whether the next input byte starts a line.
+    at_line_start: bool,
+    /// Whether a header has been seen; sequence before the first one is ignored.
+    in_record: bool,
+}
+
+impl<'a> FastaParser<'a> {
+    pub fn new(path: &'a str) -> Self {
+        FastaParser {
+            path,
+            level: simd_level(),
+            genome: Genome::new(),
+            staged: Vec::with_capacity(STAGED_BASES + BLOCK_LEN),
+            index: None,
+            open_record: None,
+            header: None,
+            header_start: 0,
+            offset: 0,
+            at_line_start: true,
+            in_record: false,
+        }
+    }
+
+    pub fn indexer(path: &'a str) -> Self {
+        FastaParser { index: Some(Vec::new()), ..FastaParser::new(path) }
+    }
+
+    fn feed_stream<R: Read>(&mut self, mut reader: R) -> Result<(), Error> {
+        let mut buffer = vec![0u8; STREAM_CHUNK_LEN];
+        loop {
+            match reader.read(&mut buffer) {
+                Ok(0) => return Ok(()),
+                Ok(n) => self.feed(&buffer[..n])?,
+                Err(e) if e.kind() == ErrorKind::Interrupted => {}
+                Err(e) => return Err(Error::new(e.kind(), format!("Error reading from FASTA file '{}': {}", self.path, e))),
+            }
+        }
+    }
+
+    /// Feeds `range` of the data a BGZF file inflates to; see `bgzf::read_range`.
+    pub fn feed_bgzf_range(&mut self, data: &[u8], index: &bgzf::BlockIndex, range: Range<u64>) -> Result<(), Error> {
+        let path = self.path;
+        bgzf::read_range(data, index, range, BGZF_BATCH_BLOCKS, |piece| self.feed(piece))
+            .map_err(|e| Error::new(e.kind(), format!("Error reading BGZF file '{}': {}", path, e)))
+    }
+
+    /// Decompresses a (possibly multi-member) gzip stream on its own thread,
+    /// which runs up to `GZIP_PIPELINE_DEPTH` chunks ahead of the parser;
+    /// chunk buffers go back and forth instead of being reallocated.
+    fn feed_gzip_pipelined<R: Read + Send>(&mut self, reader: R) -> Result<(), Error> {
+        let path = self.path;
+        let (full_tx, full_rx) = bounded::<Vec<u8>>(GZIP_PIPELINE_DEPTH);
+        let (empty_tx, empty_rx) = bounded::<Vec<u8>>(GZIP_PIPELINE_DEPTH + 1);
+        for _ in 0..=GZIP_PIPELINE_DEPTH {
+            empty_tx.send(Vec::with_capacity(STREAM_CHUNK_LEN)).expect("the receiver is alive");
+        }
+        thread::scope(|scope| {
+            let decompressor = scope.spawn(move || -> Result<(), Error> {
+                let mut decoder = MultiGzDecoder::new(reader);
+                for mut buffer in empty_rx.iter() {
+                    buffer.resize(STREAM_CHUNK_LEN, 0);
+                    let mut filled = 0;
+                    while filled < buffer.len() {
+                        match decoder.read(&mut buffer[filled..]) {
+                            Ok(0) => break,
+                            Ok(n) => filled += n,
+                            Err(e) if e.kind() == ErrorKind::Interrupted => {}
+                            Err(e) => return Err(Error::new(e.kind(), format!("Error decompressing FASTA file '{}': {}", path, e))),
+                        }
+                    }
+                    if filled == 0 {
+                        break;
+                    }
+                    buffer.truncate(filled);
+                    if full_tx.send(buffer).is_err() {
+                        break;
+                    }
+                }
+                Ok(())
+            });
+            let mut parsed = Ok(());
+            for buffer in full_rx.iter() {
+                parsed = self.feed(&buffer);
+                if parsed.is_err() {
+                    break;
+                }
+                let _ = empty_tx.send(buffer);
+            }
+            // Unblocks the decompressor if parsing stopped early.
+            drop(empty_tx);
+            drop(full_rx);
+            let decompressed = decompressor.join().expect("gzip decompression thread panicked");
+            parsed.and(decompressed)
+        })
+    }
+
+    pub fn feed(&mut self, data: &[u8]) -> Result<(), Error> {
+        let mut input = data;
+        while !input.is_empty() {
+            let input_start = self.offset + (data.len() - input.len()) as u64;
+            if let Some(header) = &mut self.header {
+                match input.iter().position(|&byte| byte == b'\n') {
+                    Some(end) => {
+                        header.extend_from_slice(&input[..end]);
+                        input = &input[end + 1..];
+                        self.finish_header(input_start + end as u64 + 1)?;
+                        self.at_line_start = true;
+                    }
+                    None => {
+                        header.extend_from_slice(input);
+                        break;
+                    }
+                }
+            } else {
+                let consumed = self.scan_sequence(input);
+                if self.header.is_some() {
+                    self.header_start = input_start + consumed as u64 - 1;
                 }
+                input = &input[consumed..];
             }
-            let header_content = line[1..].trim();
-            let new_chrom_name = header_content.split_whitespace().next().unwrap_or(header_content);
-            if new_chrom_name.is_empty() {
-                 return Err(Error::new(ErrorKind::InvalidData, format!("Encountered an empty chromosome name after '>' in file '{}'. Line: '{}'", path, line)));
-            }
-            current_header_name = Some(new_chrom_name.to_string());
-            current_sequence = Vec::with_capacity(APPROX_CHROMOSOME_CAPACITY);
-        } else if current_header_name.is_some() {
-            for char_byte in line.trim().bytes() {
-                let upper_char = char_byte.to_ascii_uppercase();
-                match upper_char {
-                    b'A' | b'C' | b'G' | b'T' | b'N' => current_sequence.push(upper_char),
-                    _ => { /* Ignore other characters */ }
+        }
+        self.offset += data.len() as u64;
+        Ok(())
+    }
+
+    /// Appends the bases of `input` up to the next header line and returns the
+    /// number of bytes consumed, including that header's '>'.
+    fn scan_sequence(&mut self, input: &[u8]) -> usize {
+        let mut tail = [0u8; BLOCK_LEN];
+        let mut pos = 0;
+        while pos < input.len() {
+            let block_len = (input.len() - pos).min(BLOCK_LEN);
+            let block: &[u8; BLOCK_LEN] = match input[pos..].first_chunk() {
+                Some(block) => block,
+                None => {
+                    // Padding bytes are zero: neither newline, '>' nor a base.
+                    tail[..block_len].copy_from_slice(&input[pos..]);
+                    tail[block_len..].fill(0);
+                    &tail
                 }
+            };
+            let masks = classify_block(self.level, block);
+            let line_starts = (masks.newlines << 1) | self.at_line_start as u64;
+            let header_starts = masks.headers & line_starts & low_bits(block_len);
+            let end = if header_starts != 0 { header_starts.trailing_zeros() as usize } else { block_len };
+            if self.in_record {
+                self.push_runs(block, masks.bases & low_bits(end));
             }
+            if header_starts != 0 {
+                self.header = Some(Vec::new());
+                return pos + end + 1;
+            }
+            self.at_line_start = masks.newlines >> (block_len - 1) & 1 == 1;
+            pos += block_len;
+        }
+        pos
+    }
+
+    /// Takes the bases of `block` selected by `mask`, one contiguous run at a time.
+    #[inline]
+    fn push_runs(&mut self, block: &[u8; BLOCK_LEN], mut mask: u64) {
+        if let Some(record) = &mut self.open_record {
+            record.len += mask.count_ones() as usize;
+            return;
+        }
+        while mask != 0 {
+            let start = mask.trailing_zeros() as usize;
+            let run = (mask >> start).trailing_ones() as usize;
+            self.staged.extend_from_slice(&block[start..start + run]);
+            mask &= !(low_bits(run) << start);
+        }
+        if self.staged.len() >= STAGED_BASES {
+            self.flush_staged();
+        }
+    }
+
+    fn flush_staged(&mut self) {
+        self.genome.push_bases(&self.staged);
+        self.staged.clear();
+    }
+
+    /// Starts a contig whose sequence lines come next, without a header line;
+    /// for reading contigs by index.
+    pub fn begin_indexed_contig(&mut self, name: String) {
+        self.flush_staged();
+        self.genome.begin_contig(name);
+        self.header = None;
+        self.at_line_start = true;
+        self.in_record = true;
+    }
+
+    /// Records the open contig, whose sequence lines end at `end`. Returns its
+    /// name and whether it had any bases; empty contigs are not recorded.
+    fn finish_contig(&mut self, end: u64) -> Option<(String, bool)> {
+        let Some(index) = &mut self.index else {
+            self.flush_staged();
+            return self.genome.finish_contig();
+        };
+        let mut record = self.open_record.take()?;
+        if record.len == 0 {
+            return Some((record.name, false));
         }
+        record.lines.end = end;
+        index.push(record);
+        index.last().map(|record| (record.name.clone(), true))
     }
-    if let Some(header_name) = current_header_name.take() {
-        if !current_sequence.is_empty() {
-            chromosomes.push((header_name, current_sequence));
+
+    /// Handles the header line just read; the sequence lines start at `lines_start`.
+    fn finish_header(&mut self, lines_start: u64) -> Result<(), Error> {
+        let line = self.header.take().unwrap_or_default();
+        if let Some((header_name, false)) = self.finish_contig(self.header_start) {
+            eprintln!("Warning: Chromosome/sequence entry '{}' in file '{}' had no sequence data. Skipping.", header_name, self.path);
+        }
+        let line = std::str::from_utf8(&line)
+            .map_err(|_| Error::new(ErrorKind::InvalidData, format!("Chromosome header in FASTA file '{}' is not valid UTF-8.", self.path)))?;
+        let header_content = line.trim();
+        let new_chrom_name = header_content.split_whitespace().next().unwrap_or(header_content);
+        if new_chrom_name.is_empty() {
+             return Err(Error::new(ErrorKind::InvalidData, format!("Encountered an empty chromosome name after '>' in file '{}'. Line: '>{}'", self.path, line)));
+        }
+        if self.index.is_some() {
+            self.open_record = Some(IndexedContig { name: new_chrom_name.to_string(), len: 0, lines: lines_start..lines_start });
         } else {
-            eprintln!("Warning: Last chromosome/sequence entry '{}' in file '{}' had no sequence data. Skipping.", header_name, path);
+            if self.genome.get(new_chrom_name).is_some() {
+                eprintln!("Warning: Chromosome/sequence name '{}' appears more than once in file '{}'. Each entry is processed separately.", new_chrom_name, self.path);
+            }
+            self.genome.begin_contig(new_chrom_name.to_string());
         }
+        self.in_record = true;
+        Ok(())
     }
 
-    if chromosomes.is_empty() && (path.ends_with(".fa") || path.ends_with(".fasta") || path.ends_with(".fa.gz") || path.ends_with(".fasta.gz")) {
-         println!("Warning: No valid chromosome sequences found in '{}'. Output will be empty if this was the only input.", path);
+    fn finish_input(&mut self) -> Result<(), Error> {
+        if self.header.is_some() {
+            self.finish_header(self.offset)?;
+        }
+        if let Some((header_name, false)) = self.finish_contig(self.offset) {
+            eprintln!("Warning: Last chromosome/sequence entry '{}' in file '{}' had no sequence data. Skipping.", header_name, self.path);
+        }
+        Ok(())
+    }
+
+    pub fn finish(mut self) -> Result<Genome, Error> {
+        self.finish_input()?;
+        Ok(self.genome.finish())
+    }
+
+    /// The contigs an indexer found, in file order.
+    pub fn finish_index(mut self) -> Result<Vec<IndexedContig>, Error> {
+        self.finish_input()?;
+        Ok(self.index.take().unwrap_or_default())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn parse_in_pieces(input: &[u8], piece_len: usize) -> Vec<(String, Vec<u8>)> {
+        let mut parser = FastaParser::new("test.fa");
+        for piece in input.chunks(piece_len) {
+            parser.feed(piece).unwrap();
+        }
+        let (sequence, contigs) = parser.finish().unwrap().into_parts();
+        contigs.into_iter().map(|contig| (contig.name, sequence.to_ascii(contig.range))).collect()
+    }
+
+    #[test]
+    fn test_parse_fasta() {
+        let long_line: Vec<u8> = b"acgtnNNxACGT".iter().copied().cycle().take(150).collect();
+        let mut input = b"ignored\n>chr1 description\r\nACGT>\nnn-ac\n>empty\n>chr2\n".to_vec();
+        input.extend_from_slice(&long_line);
+        input.extend_from_slice(b"\n>chr3");
+        let expected_chr2: Vec<u8> = long_line.iter().map(|b| b.to_ascii_uppercase()).filter(|b| b"ACGTN".contains(b)).collect();
+        for piece_len in [1, 7, 64, 1000] {
+            let contigs = parse_in_pieces(&input, piece_len);
+            assert_eq!(contigs.len(), 2);
+            assert_eq!(contigs[0], ("chr1".to_string(), b"ACGTNNAC".to_vec()));
+            assert_eq!(contigs[1], ("chr2".to_string(), expected_chr2.clone()));
+        }
+    }
+
+    #[test]
+    fn test_parse_compressed_fasta() {
+        let mut input = Vec::new();
+        for i in 0..50 {
+            input.extend_from_slice(format!(">chr{}\n", i).as_bytes());
+            for line in 0..40 {
+                input.extend_from_slice(&b"ACGTTGCAN"[..(i + line) % 9 + 1]);
+                input.push(b'\n');
+            }
+        }
+        let expected = parse_in_pieces(&input, input.len());
+        let collect = |parser: FastaParser| {
+            let (sequence, contigs) = parser.finish().unwrap().into_parts();
+            contigs.into_iter().map(|contig| (contig.name, sequence.to_ascii(contig.range))).collect::<Vec<_>>()
+        };
+
+        let compressed = bgzf::compress(&input, 1000);
+        let index = bgzf::BlockIndex::from_blocks(&compressed).unwrap();
+        let mut parser = FastaParser::new("test.fa.gz");
+        parser.feed_bgzf_range(&compressed, &index, 0..index.uncompressed_len()).unwrap();
+        assert_eq!(collect(parser), expected);
+
+        let mut parser = FastaParser::new("test.fa.gz");
+        parser.feed_gzip_pipelined(&bgzf::compress(&input, 4000)[..]).unwrap();
+        assert_eq!(collect(parser), expected);
+    }
+
+    #[test]
+    fn test_classify_block_matches_portable() {
+        let mut seed = 5u64;
+        for _ in 0..100 {
+            let block: [u8; BLOCK_LEN] = std::array::from_fn(|_| {
+                seed = seed.wrapping_mul(6364136223846793005).wrapping_add(1442695040888963407);
+                b"aAcCgGtTnN>\n\rxX-"[(seed >> 33) as usize % 16]
+            });
+            let (expected, masks) = (classify_block_portable(&block), classify_block(simd_level(), &block));
+            assert_eq!((masks.newlines, masks.headers, masks.bases), (expected.newlines, expected.headers, expected.bases));
+        }
     }
-    Ok(chromosomes)
-}
\ No newline at end of file
+}
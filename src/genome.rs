@@ -0,0 +1,121 @@
+//! Arena-backed contig store.
+//!
+//! Every sequence of an assembly lives back to back in one packed arena, and a
+//! table maps each contig name to its base range in it. Nothing is reserved per
+//! contig, so memory follows genome size rather than contig count: a draft
+//! assembly with tens of thousands of scaffolds costs the same as a few
+//! chromosomes of the same total length.
+
+use crate::packed::PackedSequence;
+use std::collections::HashMap;
+use std::ops::Range;
+use std::sync::Arc;
+
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct Contig {
+    pub name: String,
+    /// Base range of the contig in the arena.
+    pub range: Range<usize>,
+}
+
+#[derive(Default)]
+pub struct Genome {
+    sequence: PackedSequence,
+    contigs: Vec<Contig>,
+    index: HashMap<String, usize>,
+    /// Start of the contig being appended, if any.
+    open_contig: Option<(String, usize)>,
+}
+
+impl Genome {
+    pub fn new() -> Self {
+        Genome::default()
+    }
+
+    /// Starts a new contig; bases pushed from now on belong to it. Any open
+    /// contig is finished first.
+    pub fn begin_contig(&mut self, name: String) {
+        self.finish_contig();
+        self.open_contig = Some((name, self.sequence.len()));
+    }
+
+    /// Appends `ACGTN` bases, in either case, to the open contig.
+    #[inline]
+    pub fn push_bases(&mut self, bases: &[u8]) {
+        self.sequence.extend_from_ascii(bases);
+    }
+
+    /// Appends `len` bases, already packed like the arena's storage words, to
+    /// the open contig.
+    pub fn push_packed(&mut self, words: &[u64], len: usize) {
+        self.sequence.extend_from_words(words, len);
+    }
+
+    /// Marks `range` of the open contig, past any range marked before, as `N`.
+    pub fn mark_n_run(&mut self, range: Range<usize>) {
+        let start = self.open_contig.as_ref().map_or(0, |&(_, start)| start);
+        self.sequence.add_n_run(start + range.start..start + range.end);
+    }
+
+    /// Records the open contig. Returns its name and whether it had any
+    /// bases; empty contigs are not recorded.
+    pub fn finish_contig(&mut self) -> Option<(String, bool)> {
+        let (name, start) = self.open_contig.take()?;
+        let range = start..self.sequence.len();
+        if range.is_empty() {
+            return Some((name, false));
+        }
+        // The first contig of a name keeps it in the index; later ones are still listed.
+        self.index.entry(name.clone()).or_insert(self.contigs.len());
+        self.contigs.push(Contig { name: name.clone(), range });
+        Some((name, true))
+    }
+
+    /// Finishes the open contig and releases the arena's spare capacity.
+    pub fn finish(mut self) -> Self {
+        self.finish_contig();
+        self.sequence.shrink_to_fit();
+        self
+    }
+
+    pub fn contigs(&self) -> &[Contig] {
+        &self.contigs
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.contigs.is_empty()
+    }
+
+    pub fn get(&self, name: &str) -> Option<&Contig> {
+        self.index.get(name).map(|&i| &self.contigs[i])
+    }
+
+    /// Splits the store into the shared arena and the contig table.
+    pub fn into_parts(self) -> (Arc<PackedSequence>, Vec<Contig>) {
+        (Arc::new(self.sequence), self.contigs)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_genome_arena() {
+        let mut genome = Genome::new();
+        for (name, seq) in [("chr1", &b"ACGTN"[..]), ("empty", &b""[..]), ("chr2", &b"NNGG"[..]), ("chr1", &b"T"[..])] {
+            genome.begin_contig(name.to_string());
+            genome.push_bases(seq);
+        }
+        assert_eq!(genome.finish_contig(), Some(("chr1".to_string(), true)));
+        let genome = genome.finish();
+        assert_eq!(genome.contigs().len(), 3);
+        assert_eq!(genome.get("chr2").map(|contig| contig.range.clone()), Some(5..9));
+        assert_eq!(genome.get("chr1").map(|contig| contig.range.clone()), Some(0..5));
+        assert!(genome.get("empty").is_none());
+
+        let (sequence, contigs) = genome.into_parts();
+        assert_eq!(sequence.to_ascii(contigs[1].range.clone()), b"NNGG");
+        assert_eq!(sequence.to_ascii(contigs[2].range.clone()), b"T");
+    }
+}
@@ -1,9 +1,918 @@
 /// Computes Levenshtein distance between two byte slices.
-/// Uses O(min(m,n)) space and O(m*n) time.
+/// When the shorter slice fits in a machine word (<= 128 bytes) the
+/// single-word Myers kernel is used; longer inputs go through a one-off
+/// `MyersProfile`. Callers comparing one sequence against many should build
+/// the profile themselves and reuse it.
 pub fn levenshtein_distance(s1: &[u8], s2: &[u8]) -> u16 {
     if s1.is_empty() { return s2.len() as u16; }
     if s2.is_empty() { return s1.len() as u16; }
 
+    let (pattern, text) = if s1.len() <= s2.len() { (s1, s2) } else { (s2, s1) };
+    if pattern.len() <= u64::BITS as usize {
+        myers_distance_u64(pattern, text)
+    } else if pattern.len() <= u128::BITS as usize {
+        myers_distance_u128(pattern, text)
+    } else {
+        MyersProfile::new(pattern).distance(text)
+    }
+}
+
+/// Number of 64-bit blocks whose column state `MyersProfile::distance` keeps on
+/// the stack (2048bp of pattern); longer patterns spill to a heap buffer.
+const MYERS_STACK_BLOCKS: usize = 32;
+
+/// Pattern-equality bitmasks for the blocked (multi-word) Myers kernel.
+/// Building the profile costs O(m); each `distance` call then costs
+/// O(n * ceil(m/64)) word operations, so a fixed `seq1` should be profiled
+/// once and reused against every `seq2`.
+pub struct MyersProfile {
+    /// Kept for the diagonal-transition probe of `distance_adaptive`.
+    pattern: Vec<u8>,
+    pattern_len: usize,
+    num_blocks: usize,
+    /// Maps a byte to its row in `peq`; class 0 is "absent from the pattern".
+    symbol_class: [u16; 256],
+    /// `num_blocks` words per symbol class, class-major.
+    peq: Vec<u64>,
+}
+
+impl MyersProfile {
+    pub fn new(pattern: &[u8]) -> Self {
+        let num_blocks = pattern.len().div_ceil(64);
+        let mut symbol_class = [0u16; 256];
+        let mut num_classes = 1;
+        for &c in pattern {
+            if symbol_class[c as usize] == 0 {
+                symbol_class[c as usize] = num_classes;
+                num_classes += 1;
+            }
+        }
+
+        let mut peq = vec![0u64; num_classes as usize * num_blocks];
+        for (i, &c) in pattern.iter().enumerate() {
+            let class = symbol_class[c as usize] as usize;
+            peq[class * num_blocks + i / 64] |= 1u64 << (i % 64);
+        }
+
+        MyersProfile { pattern: pattern.to_vec(), pattern_len: pattern.len(), num_blocks, symbol_class, peq }
+    }
+
+    /// Levenshtein distance between the profiled pattern and `text`.
+    pub fn distance(&self, text: &[u8]) -> u16 {
+        if self.pattern_len == 0 { return text.len() as u16; }
+        if text.is_empty() { return self.pattern_len as u16; }
+
+        if self.num_blocks <= MYERS_STACK_BLOCKS {
+            let mut pv = [!0u64; MYERS_STACK_BLOCKS];
+            let mut mv = [0u64; MYERS_STACK_BLOCKS];
+            self.distance_with_state(text, &mut pv[..self.num_blocks], &mut mv[..self.num_blocks])
+        } else {
+            let mut pv = vec![!0u64; self.num_blocks];
+            let mut mv = vec![0u64; self.num_blocks];
+            self.distance_with_state(text, &mut pv, &mut mv)
+        }
+    }
+
+    /// Distances between equal-length prefixes, `out[t] = D(pattern[..L], text[..L])`
+    /// for each `L = prefix_lens[t]`, from a single pass of the blocked Myers
+    /// kernel over `text[..max L]`. `prefix_lens` must be ascending and no
+    /// longer than either sequence. Because the tier windows all start at the
+    /// same locus, one pass over the largest window yields every tier.
+    pub fn prefix_distances(&self, text: &[u8], prefix_lens: &[usize], out: &mut [u16]) {
+        assert_eq!(prefix_lens.len(), out.len(), "prefix_distances: output length must match prefix count");
+        assert!(prefix_lens.windows(2).all(|w| w[0] <= w[1]), "prefix_distances: prefix lengths must be ascending");
+        let max_len = prefix_lens.last().copied().unwrap_or(0);
+        assert!(max_len <= self.pattern_len && max_len <= text.len(), "prefix_distances: prefix longer than the sequences");
+
+        // Rows below the longest prefix never influence the rows above it.
+        let blocks = max_len.div_ceil(64);
+        if blocks <= MYERS_STACK_BLOCKS {
+            let mut pv = [!0u64; MYERS_STACK_BLOCKS];
+            let mut mv = [0u64; MYERS_STACK_BLOCKS];
+            self.prefix_distances_with_state(text, prefix_lens, out, &mut pv[..blocks], &mut mv[..blocks]);
+        } else {
+            let mut pv = vec![!0u64; blocks];
+            let mut mv = vec![0u64; blocks];
+            self.prefix_distances_with_state(text, prefix_lens, out, &mut pv, &mut mv);
+        }
+    }
+
+    fn prefix_distances_with_state(&self, text: &[u8], prefix_lens: &[usize], out: &mut [u16], pv: &mut [u64], mv: &mut [u64]) {
+        let mut next = prefix_lens.iter().take_while(|&&len| len == 0).count();
+        out[..next].fill(0);
+        let max_len = prefix_lens.last().copied().unwrap_or(0);
+
+        for (j, &c) in text[..max_len].iter().enumerate() {
+            let class_offset = self.symbol_class[c as usize] as usize * self.num_blocks;
+            let eq = &self.peq[class_offset..class_offset + pv.len()];
+            let (mut hin_pos, mut hin_neg) = (1u64, 0u64);
+            for ((pv_b, mv_b), &eq_b) in pv.iter_mut().zip(mv.iter_mut()).zip(eq) {
+                let (ph, mh) = advance_myers_block(pv_b, mv_b, eq_b, hin_pos, hin_neg);
+                hin_pos = ph >> 63;
+                hin_neg = mh >> 63;
+            }
+
+            let column = j + 1;
+            while next < prefix_lens.len() && prefix_lens[next] == column {
+                out[next] = column_value(pv, mv, column, column);
+                next += 1;
+            }
+        }
+    }
+
+    /// Same result as `distance`, chosen per pair: near-identical windows
+    /// (segmental duplications, repeats) are detected by a Hamming probe or a
+    /// small diagonal-transition attempt and finished in O((m+n) * d), and
+    /// everything else goes through the blocked Myers kernel.
+    pub fn distance_adaptive(&self, text: &[u8]) -> u16 {
+        self.probe_similar(text, usize::MAX).unwrap_or_else(|| self.distance(text))
+    }
+
+    /// Exact distance from the diagonal-transition kernel when the pair looks
+    /// near-identical and the distance is at most `max_edits`.
+    fn probe_similar(&self, text: &[u8], max_edits: usize) -> Option<u16> {
+        let hamming = hamming_upper_bound(&self.pattern, text);
+        if hamming <= DIAGONAL_TRANSITION_HAMMING_LIMIT {
+            diagonal_transition_distance(&self.pattern, text, hamming.min(max_edits))
+        } else {
+            let budget = DIAGONAL_TRANSITION_PROBE_EDITS.min(max_edits);
+            diagonal_transition(&self.pattern, text, budget, DIAGONAL_TRANSITION_PROBE_ROWS_PER_EDIT)
+        }
+    }
+
+    fn distance_with_state(&self, text: &[u8], pv: &mut [u64], mv: &mut [u64]) -> u16 {
+        let last_block = self.num_blocks - 1;
+        let last_row_shift = (self.pattern_len - 1) % 64;
+        let mut score = self.pattern_len as u16;
+        let (inner_pv, last_pv) = pv.split_at_mut(last_block);
+        let (inner_mv, last_mv) = mv.split_at_mut(last_block);
+
+        for &c in text {
+            let class_offset = self.symbol_class[c as usize] as usize * self.num_blocks;
+            let eq = &self.peq[class_offset..class_offset + self.num_blocks];
+            // Row 0 of a global alignment grows by one per text byte.
+            let (mut hin_pos, mut hin_neg) = (1u64, 0u64);
+            for ((pv_b, mv_b), &eq_b) in inner_pv.iter_mut().zip(inner_mv.iter_mut()).zip(eq) {
+                let (ph, mh) = advance_myers_block(pv_b, mv_b, eq_b, hin_pos, hin_neg);
+                hin_pos = ph >> 63;
+                hin_neg = mh >> 63;
+            }
+            let (ph, mh) = advance_myers_block(&mut last_pv[0], &mut last_mv[0], eq[last_block], hin_pos, hin_neg);
+            let hout = ((ph >> last_row_shift) & 1) as i16 - ((mh >> last_row_shift) & 1) as i16;
+            score = score.wrapping_add_signed(hout);
+        }
+        score
+    }
+
+    /// Block holding 1-based pattern row `row`, clamped to the pattern.
+    fn block_of_row(&self, row: isize) -> usize {
+        ((row.clamp(1, self.pattern_len as isize) - 1) / 64) as usize
+    }
+
+    fn rows_in_block(&self, b: usize) -> isize {
+        (self.pattern_len - b * 64).min(64) as isize
+    }
+
+    /// Levenshtein distance to `text` if it is at most `max_distance`,
+    /// otherwise `max_distance + 1`. Only the blocks intersecting Ukkonen's
+    /// band are advanced: a cell can lie on an alignment of cost <= k only if
+    /// `|i - j| + |(m - i) - (n - j)| <= k`, so with equal lengths the band is
+    /// k/2 rows either side of the diagonal. Blocks that leave the top of the
+    /// band are dropped (the row above the first live block is treated as
+    /// growing by one per column, which can only overestimate), and the scan
+    /// stops as soon as no live cell can be within `max_distance`.
+    pub fn distance_bounded(&self, text: &[u8], max_distance: u16) -> u16 {
+        let k = max_distance as isize;
+        let saturated = max_distance.saturating_add(1);
+        let (m, n) = (self.pattern_len as isize, text.len() as isize);
+        let length_diff = m - n;
+        if length_diff.abs() > k { return saturated; }
+        if m == 0 || n == 0 { return (m.max(n) as u16).min(saturated); }
+        if let Some(dist) = self.probe_similar(text, max_distance as usize) {
+            return dist;
+        }
+
+        // Rows i of column j that can be on a cheap enough alignment satisfy
+        // diag_lo <= i - j <= diag_hi.
+        let diag_lo = (length_diff - k).div_euclid(2) + (length_diff - k).rem_euclid(2);
+        let diag_hi = (length_diff + k).div_euclid(2);
+        if self.num_blocks <= MYERS_STACK_BLOCKS {
+            let mut pv = [!0u64; MYERS_STACK_BLOCKS];
+            let mut mv = [0u64; MYERS_STACK_BLOCKS];
+            let mut score = [0isize; MYERS_STACK_BLOCKS];
+            self.bounded_with_state(text, k, (diag_lo, diag_hi), &mut pv, &mut mv, &mut score)
+        } else {
+            let mut pv = vec![!0u64; self.num_blocks];
+            let mut mv = vec![0u64; self.num_blocks];
+            let mut score = vec![0isize; self.num_blocks];
+            self.bounded_with_state(text, k, (diag_lo, diag_hi), &mut pv, &mut mv, &mut score)
+        }
+        .min(saturated)
+    }
+
+    fn bounded_with_state(&self, text: &[u8], k: isize, (diag_lo, diag_hi): (isize, isize), pv: &mut [u64], mv: &mut [u64], score: &mut [isize]) -> u16 {
+        let last_row_shift = (self.pattern_len - 1) % 64;
+        let mut first_block = 0;
+        let mut last_block = self.block_of_row(diag_hi);
+        // Column 0: D[i][0] = i.
+        for b in 0..=last_block {
+            score[b] = b as isize * 64 + self.rows_in_block(b);
+        }
+
+        for (j, &c) in text.iter().enumerate() {
+            let column = j as isize + 1;
+            let wanted_last = self.block_of_row(column + diag_hi);
+            if wanted_last > last_block {
+                // Entering the band from below: start from all +1 vertical deltas,
+                // an overestimate of the untouched column-(j-1) values.
+                last_block = wanted_last;
+                pv[last_block] = !0;
+                mv[last_block] = 0;
+                score[last_block] = score[last_block - 1] + self.rows_in_block(last_block);
+            }
+            first_block = first_block.max(self.block_of_row(column + diag_lo)).min(last_block);
+
+            let class_offset = self.symbol_class[c as usize] as usize * self.num_blocks;
+            let eq = &self.peq[class_offset..class_offset + self.num_blocks];
+            let (mut hin_pos, mut hin_neg) = (1u64, 0u64);
+            let mut all_above_limit = true;
+            for b in first_block..=last_block {
+                let (ph, mh) = advance_myers_block(&mut pv[b], &mut mv[b], eq[b], hin_pos, hin_neg);
+                let out_shift = if b + 1 == self.num_blocks { last_row_shift } else { 63 };
+                score[b] += ((ph >> out_shift) & 1) as isize - ((mh >> out_shift) & 1) as isize;
+                hin_pos = ph >> 63;
+                hin_neg = mh >> 63;
+                // Vertical deltas are at least -1, so no cell of the block is below this.
+                all_above_limit &= score[b] - (self.rows_in_block(b) - 1) > k;
+            }
+            if all_above_limit {
+                return (k + 1) as u16;
+            }
+        }
+        score[self.num_blocks - 1].min(k + 1) as u16
+    }
+}
+
+/// Advances one 64-row block of the Myers column by one text byte.
+/// `hin_pos`/`hin_neg` (0 or 1) encode the horizontal delta entering the
+/// block's top row. Returns the block's horizontal +1/-1 vectors before the
+/// shift; their top bit is the delta handed to the next block.
+#[inline(always)]
+fn advance_myers_block(pv: &mut u64, mv: &mut u64, eq: u64, hin_pos: u64, hin_neg: u64) -> (u64, u64) {
+    let xv = eq | *mv;
+    let eq = eq | hin_neg;
+    let xh = ((eq & *pv).wrapping_add(*pv) ^ *pv) | eq;
+    let ph = *mv | !(xh | *pv);
+    let mh = *pv & xh;
+    let ph_shifted = (ph << 1) | hin_pos;
+    let mh_shifted = (mh << 1) | hin_neg;
+    *pv = mh_shifted | !(xv | ph_shifted);
+    *mv = ph_shifted & xv;
+    (ph, mh)
+}
+
+/// D[row][column] recovered from a Myers column: D[0][column] = column plus
+/// the vertical deltas of rows 1..=row.
+fn column_value(pv: &[u64], mv: &[u64], column: usize, row: usize) -> u16 {
+    let full_blocks = row / 64;
+    let mut value = column as isize;
+    for (p, m) in pv[..full_blocks].iter().zip(&mv[..full_blocks]) {
+        value += p.count_ones() as isize - m.count_ones() as isize;
+    }
+    let rest = row % 64;
+    if rest > 0 {
+        let mask = (1u64 << rest) - 1;
+        value += (pv[full_blocks] & mask).count_ones() as isize - (mv[full_blocks] & mask).count_ones() as isize;
+    }
+    value as u16
+}
+
+/// Pairs whose Hamming distance is at most this go straight to the
+/// diagonal-transition kernel, which then needs at most that many rounds.
+const DIAGONAL_TRANSITION_HAMMING_LIMIT: usize = 32;
+
+/// Otherwise the diagonal-transition kernel is tried with this edit budget,
+/// which catches near-identical windows shifted by indels...
+const DIAGONAL_TRANSITION_PROBE_EDITS: usize = 32;
+
+/// ...but gives up once it advances fewer rows than this per edit spent.
+/// Unrelated DNA advances only a few rows per edit and is abandoned within a
+/// handful of rounds, so the probe costs almost nothing on ordinary pairs.
+const DIAGONAL_TRANSITION_PROBE_ROWS_PER_EDIT: isize = 16;
+const DIAGONAL_TRANSITION_PROBE_GRACE_EDITS: isize = 4;
+
+/// Largest edit budget `diagonal_transition_distance` accepts; bounds its
+/// stack-resident furthest-reaching arrays.
+const DIAGONAL_TRANSITION_MAX_EDITS: usize = 64;
+
+/// Mismatching positions over the common length plus the length difference:
+/// an upper bound on the Levenshtein distance, computed 8 bytes per XOR.
+pub fn hamming_upper_bound(s1: &[u8], s2: &[u8]) -> usize {
+    let common = s1.len().min(s2.len());
+    let (a, b) = (&s1[..common], &s2[..common]);
+    let mut mismatches = 0;
+    let mut a_words = a.chunks_exact(8);
+    let mut b_words = b.chunks_exact(8);
+    for (wa, wb) in a_words.by_ref().zip(b_words.by_ref()) {
+        let diff = u64::from_le_bytes(wa.try_into().unwrap()) ^ u64::from_le_bytes(wb.try_into().unwrap());
+        // Fold each byte onto its low bit, then count bytes with any bit set.
+        let folded = diff | (diff >> 4);
+        let folded = folded | (folded >> 2);
+        let folded = folded | (folded >> 1);
+        mismatches += (folded & 0x0101_0101_0101_0101).count_ones() as usize;
+    }
+    mismatches += a_words.remainder().iter().zip(b_words.remainder()).filter(|(x, y)| x != y).count();
+    mismatches + s1.len().abs_diff(s2.len())
+}
+
+/// Symbol bins counted by `BaseComposition`; any other byte shares the last
+/// bin, which only loosens the bound.
+const COMPOSITION_BINS: usize = 6;
+
+const fn composition_bin_table() -> [u8; 256] {
+    let mut table = [(COMPOSITION_BINS - 1) as u8; 256];
+    table[b'A' as usize] = 0;
+    table[b'C' as usize] = 1;
+    table[b'G' as usize] = 2;
+    table[b'T' as usize] = 3;
+    table[b'N' as usize] = 4;
+    table
+}
+
+static COMPOSITION_BIN: [u8; 256] = composition_bin_table();
+
+/// Per-symbol counts of a sequence, for the composition lower bound.
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct BaseComposition {
+    counts: [u32; COMPOSITION_BINS],
+}
+
+impl BaseComposition {
+    pub fn of(seq: &[u8]) -> Self {
+        let mut counts = [0u32; COMPOSITION_BINS];
+        for &b in seq {
+            counts[COMPOSITION_BIN[b as usize] as usize] += 1;
+        }
+        BaseComposition { counts }
+    }
+
+    /// Every edit changes at most one count down and one count up, so the
+    /// surplus of either sequence over the other is a lower bound on the
+    /// Levenshtein distance.
+    pub fn lower_bound(&self, other: &BaseComposition) -> usize {
+        let (mut surplus, mut deficit) = (0, 0);
+        for (&a, &b) in self.counts.iter().zip(&other.counts) {
+            if a > b {
+                surplus += (a - b) as usize;
+            } else {
+                deficit += (b - a) as usize;
+            }
+        }
+        surplus.max(deficit)
+    }
+}
+
+/// How `bound_cascade` settled a pair.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum BoundOutcome {
+    /// The composition lower bound already exceeds the threshold.
+    AboveThreshold,
+    /// The sequences are byte-identical.
+    Identical,
+    /// The composition lower bound meets the Hamming upper bound.
+    BoundsMet(u16),
+    /// The bounds leave a gap; the DP has to run.
+    NeedsDp,
+}
+
+/// Bounds a pair of equal-length sequences from cheapest to dearest check: the
+/// composition lower bound against `max_distance`, then the Hamming upper bound
+/// from `hamming`, which is 0 exactly when the sequences are identical.
+pub fn bound_cascade(comp1: &BaseComposition, comp2: &BaseComposition, max_distance: Option<u16>, hamming: impl FnOnce() -> usize) -> BoundOutcome {
+    let lower = comp1.lower_bound(comp2);
+    if max_distance.is_some_and(|k| lower > k as usize) {
+        return BoundOutcome::AboveThreshold;
+    }
+    let upper = hamming();
+    if upper == 0 {
+        return BoundOutcome::Identical;
+    }
+    if upper == lower {
+        return BoundOutcome::BoundsMet(upper as u16);
+    }
+    BoundOutcome::NeedsDp
+}
+
+/// Length of the common prefix of `a` and `b`, compared a word at a time.
+#[inline]
+fn common_prefix_len(a: &[u8], b: &[u8]) -> usize {
+    let limit = a.len().min(b.len());
+    let mut i = 0;
+    while i + 8 <= limit {
+        let diff = u64::from_le_bytes(a[i..i + 8].try_into().unwrap()) ^ u64::from_le_bytes(b[i..i + 8].try_into().unwrap());
+        if diff != 0 {
+            return i + (diff.trailing_zeros() / 8) as usize;
+        }
+        i += 8;
+    }
+    while i < limit && a[i] == b[i] {
+        i += 1;
+    }
+    i
+}
+
+/// Landau-Vishkin diagonal-transition kernel: exact Levenshtein distance if it
+/// is at most `max_edits`, otherwise `None`. Round d extends, for every
+/// diagonal within d of the main one, the furthest cell reachable with d
+/// edits, so the cost is O((m+n) * d) and only O(d) state is kept.
+pub fn diagonal_transition_distance(s1: &[u8], s2: &[u8], max_edits: usize) -> Option<u16> {
+    diagonal_transition(s1, s2, max_edits, 0)
+}
+
+/// `diagonal_transition_distance` that additionally gives up (returns `None`)
+/// after any round d past the grace rounds whose furthest row is below
+/// `min_rows_per_edit * d`.
+fn diagonal_transition(s1: &[u8], s2: &[u8], max_edits: usize, min_rows_per_edit: isize) -> Option<u16> {
+    assert!(max_edits <= DIAGONAL_TRANSITION_MAX_EDITS, "diagonal_transition_distance supports at most {} edits", DIAGONAL_TRANSITION_MAX_EDITS);
+    const WIDTH: usize = 2 * DIAGONAL_TRANSITION_MAX_EDITS + 3;
+    const UNREACHED: isize = isize::MIN / 2;
+
+    let (m, n) = (s1.len() as isize, s2.len() as isize);
+    let target_diag = n - m;
+    if target_diag.unsigned_abs() > max_edits { return None; }
+
+    // furthest[k + center] is the furthest row i reached on diagonal k = j - i.
+    let center = max_edits as isize + 1;
+    let mut furthest = [UNREACHED; WIDTH];
+    let mut next = [UNREACHED; WIDTH];
+
+    let start = common_prefix_len(s1, s2) as isize;
+    if target_diag == 0 && start == m { return Some(0); }
+    furthest[center as usize] = start;
+
+    for d in 1..=max_edits as isize {
+        let lo = (-d).max(-m);
+        let hi = d.min(n);
+        let mut best_row = 0;
+        for k in lo..=hi {
+            let slot = (k + center) as usize;
+            let substitution = furthest[slot] + 1;
+            let deletion = furthest[slot + 1] + 1;
+            let insertion = furthest[slot - 1];
+            let mut i = substitution.max(deletion).max(insertion).min(m).min(n - k);
+            if i < 0 || i + k < 0 {
+                next[slot] = UNREACHED;
+                continue;
+            }
+            i += common_prefix_len(&s1[i as usize..], &s2[(i + k) as usize..]) as isize;
+            next[slot] = i;
+            if k == target_diag && i == m {
+                return Some(d as u16);
+            }
+            best_row = best_row.max(i);
+        }
+        if d > DIAGONAL_TRANSITION_PROBE_GRACE_EDITS && best_row < min_rows_per_edit * d {
+            return None;
+        }
+        std::mem::swap(&mut furthest, &mut next);
+    }
+    None
+}
+
+/// Generates a single-word Myers/Hyyro bit-vector kernel for a given word type.
+/// The pattern must be non-empty and no longer than the word; the whole column
+/// of the DP matrix is kept in the `pv`/`mv` delta vectors, so each text byte
+/// costs a constant number of word operations and nothing touches the heap.
+macro_rules! myers_single_word_kernel {
+    ($name:ident, $word:ty) => {
+        fn $name(pattern: &[u8], text: &[u8]) -> u16 {
+            debug_assert!(!pattern.is_empty() && pattern.len() <= <$word>::BITS as usize);
+
+            let mut peq = [0 as $word; 256];
+            for (i, &c) in pattern.iter().enumerate() {
+                peq[c as usize] |= (1 as $word) << i;
+            }
+
+            let last_row_bit: $word = (1 as $word) << (pattern.len() - 1);
+            let mut pv: $word = !0;
+            let mut mv: $word = 0;
+            let mut score = pattern.len() as u16;
+
+            for &c in text {
+                let eq = peq[c as usize];
+                let xv = eq | mv;
+                let xh = ((eq & pv).wrapping_add(pv) ^ pv) | eq;
+                let ph = mv | !(xh | pv);
+                let mh = pv & xh;
+                if ph & last_row_bit != 0 {
+                    score += 1;
+                } else if mh & last_row_bit != 0 {
+                    score -= 1;
+                }
+                // Row 0 of a global alignment grows by one per text byte.
+                let ph = (ph << 1) | 1;
+                let mh = mh << 1;
+                pv = mh | !(xv | ph);
+                mv = ph & xv;
+            }
+            score
+        }
+    };
+}
+
+myers_single_word_kernel!(myers_distance_u64, u64);
+myers_single_word_kernel!(myers_distance_u128, u128);
+
+/// Instruction set used by `levenshtein_batch`, chosen once at startup.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum SimdLevel {
+    Scalar,
+    Sse41,
+    Avx2,
+    Avx512,
+}
+
+impl SimdLevel {
+    pub fn name(self) -> &'static str {
+        match self {
+            SimdLevel::Scalar => "scalar",
+            SimdLevel::Sse41 => "SSE4.1",
+            SimdLevel::Avx2 => "AVX2",
+            SimdLevel::Avx512 => "AVX-512BW",
+        }
+    }
+}
+
+/// Best instruction set supported by the running CPU. Detection runs once;
+/// the binary itself is built for the baseline target so build and run hosts
+/// may differ.
+pub fn simd_level() -> SimdLevel {
+    static LEVEL: std::sync::OnceLock<SimdLevel> = std::sync::OnceLock::new();
+    *LEVEL.get_or_init(detect_simd_level)
+}
+
+#[cfg(target_arch = "x86_64")]
+fn detect_simd_level() -> SimdLevel {
+    if is_x86_feature_detected!("avx512bw") {
+        SimdLevel::Avx512
+    } else if is_x86_feature_detected!("avx2") {
+        SimdLevel::Avx2
+    } else if is_x86_feature_detected!("sse4.1") {
+        SimdLevel::Sse41
+    } else {
+        SimdLevel::Scalar
+    }
+}
+
+#[cfg(not(target_arch = "x86_64"))]
+fn detect_simd_level() -> SimdLevel {
+    SimdLevel::Scalar
+}
+
+/// Computes `levenshtein_distance(query, target)` for every target into `out`.
+/// Targets of equal length are computed in lock-step, one pair per SIMD lane:
+/// u8 lanes when the longer side is at most 254bp, so that no DP cell can
+/// reach 255 and wrap, u16 lanes otherwise.
+pub fn levenshtein_batch(query: &[u8], targets: &[&[u8]], out: &mut [u16]) {
+    levenshtein_batch_with_level(simd_level(), query, targets, out);
+}
+
+fn levenshtein_batch_with_level(level: SimdLevel, query: &[u8], targets: &[&[u8]], out: &mut [u16]) {
+    assert_eq!(targets.len(), out.len(), "levenshtein_batch: output length must match target count");
+    match level {
+        SimdLevel::Scalar => {
+            for (target, dist) in targets.iter().zip(out.iter_mut()) {
+                *dist = levenshtein_distance(query, target);
+            }
+        }
+        #[cfg(target_arch = "x86_64")]
+        SimdLevel::Sse41 => batch_in_chunks(query, targets, out, batch_sse41_u8, batch_sse41_u16),
+        #[cfg(target_arch = "x86_64")]
+        SimdLevel::Avx2 => batch_in_chunks(query, targets, out, batch_avx2_u8, batch_avx2_u16),
+        #[cfg(target_arch = "x86_64")]
+        SimdLevel::Avx512 => batch_in_chunks(query, targets, out, batch_avx512_u8, batch_avx512_u16),
+        #[cfg(not(target_arch = "x86_64"))]
+        _ => unreachable!("SIMD batch kernels are only compiled for x86_64"),
+    }
+}
+
+/// Splits `targets` into lane-sized chunks and runs the widest kernel that
+/// cannot overflow. Chunks whose targets differ in length cannot run in
+/// lock-step and are computed one pair at a time.
+#[cfg(target_arch = "x86_64")]
+fn batch_in_chunks<const L8: usize, const L16: usize>(
+    query: &[u8],
+    targets: &[&[u8]],
+    out: &mut [u16],
+    kernel_u8: unsafe fn(&[u8], &[[u8; L8]], &mut [[u8; L8]]) -> [u8; L8],
+    kernel_u16: unsafe fn(&[u8], &[[u8; L16]], &mut [[u16; L16]]) -> [u16; L16],
+) {
+    let mut start = 0;
+    while start < targets.len() {
+        let target_len = targets[start].len();
+        let max_len = query.len().max(target_len);
+        let lanes = if max_len < u8::MAX as usize { L8 } else { L16 };
+        let end = (start + lanes).min(targets.len());
+        let chunk = &targets[start..end];
+
+        if query.is_empty() || target_len == 0 || chunk.iter().any(|t| t.len() != target_len) {
+            for (target, dist) in chunk.iter().zip(out[start..end].iter_mut()) {
+                *dist = levenshtein_distance(query, target);
+            }
+        } else if lanes == L8 {
+            let columns = transpose_targets::<L8>(chunk, target_len);
+            let mut rows: Vec<[u8; L8]> = (0..=query.len()).map(|i| [i as u8; L8]).collect();
+            // SAFETY: the kernel was selected by `simd_level`, which checked CPU support.
+            let result = unsafe { kernel_u8(query, &columns, &mut rows) };
+            for (dist, &lane) in out[start..end].iter_mut().zip(result.iter()) {
+                *dist = lane as u16;
+            }
+        } else {
+            let columns = transpose_targets::<L16>(chunk, target_len);
+            let mut rows: Vec<[u16; L16]> = (0..=query.len()).map(|i| [i as u16; L16]).collect();
+            // SAFETY: as above.
+            let result = unsafe { kernel_u16(query, &columns, &mut rows) };
+            out[start..end].copy_from_slice(&result[..end - start]);
+        }
+        start = end;
+    }
+}
+
+/// Column-major copy of up to `LANES` equal-length targets; unused lanes stay zero.
+#[cfg(target_arch = "x86_64")]
+fn transpose_targets<const LANES: usize>(chunk: &[&[u8]], target_len: usize) -> Vec<[u8; LANES]> {
+    let mut columns = vec![[0u8; LANES]; target_len];
+    for (lane, target) in chunk.iter().enumerate() {
+        for (column, &c) in columns.iter_mut().zip(target.iter()) {
+            column[lane] = c;
+        }
+    }
+    columns
+}
+
+/// Lane element for the lock-step DP. Values never exceed the longer input
+/// length, which the caller guarantees fits the type.
+trait BatchLane: Copy + Ord {
+    fn from_usize(v: usize) -> Self;
+    fn plus(self, v: u8) -> Self;
+}
+
+impl BatchLane for u8 {
+    #[inline(always)]
+    fn from_usize(v: usize) -> Self { v as u8 }
+    #[inline(always)]
+    fn plus(self, v: u8) -> Self { self.wrapping_add(v) }
+}
+
+impl BatchLane for u16 {
+    #[inline(always)]
+    fn from_usize(v: usize) -> Self { v as u16 }
+    #[inline(always)]
+    fn plus(self, v: u8) -> Self { self.wrapping_add(v as u16) }
+}
+
+/// Row DP over `query` advanced one target column at a time, every operation
+/// applied to all lanes. Written on plain arrays so each `#[target_feature]`
+/// wrapper below lets LLVM vectorize it for that instruction set.
+#[inline(always)]
+fn batch_kernel<T: BatchLane, const LANES: usize>(query: &[u8], columns: &[[u8; LANES]], rows: &mut [[T; LANES]]) -> [T; LANES] {
+    debug_assert_eq!(rows.len(), query.len() + 1);
+    for (j, column) in columns.iter().enumerate() {
+        let mut diag = rows[0];
+        let mut left = [T::from_usize(j + 1); LANES];
+        rows[0] = left;
+        for (slot, &q) in rows[1..].iter_mut().zip(query) {
+            let up = *slot;
+            let mut cell = up;
+            for l in 0..LANES {
+                let substitution = diag[l].plus((column[l] != q) as u8);
+                cell[l] = substitution.min(up[l].plus(1)).min(left[l].plus(1));
+            }
+            diag = up;
+            left = cell;
+            *slot = cell;
+        }
+    }
+    rows[query.len()]
+}
+
+macro_rules! batch_kernel_for_isa {
+    ($name:ident, $feature:literal, $lane:ty, $lanes:literal) => {
+        #[cfg(target_arch = "x86_64")]
+        #[target_feature(enable = $feature)]
+        unsafe fn $name(query: &[u8], columns: &[[u8; $lanes]], rows: &mut [[$lane; $lanes]]) -> [$lane; $lanes] {
+            batch_kernel::<$lane, $lanes>(query, columns, rows)
+        }
+    };
+}
+
+batch_kernel_for_isa!(batch_sse41_u8, "sse4.1", u8, 16);
+batch_kernel_for_isa!(batch_sse41_u16, "sse4.1", u16, 8);
+batch_kernel_for_isa!(batch_avx2_u8, "avx2", u8, 32);
+batch_kernel_for_isa!(batch_avx2_u16, "avx2", u16, 16);
+batch_kernel_for_isa!(batch_avx512_u8, "avx512bw", u8, 64);
+batch_kernel_for_isa!(batch_avx512_u16, "avx512bw", u16, 32);
+
+/// Levenshtein distance between two windows of exactly `N` bytes (N <= 128).
+/// Monomorphized per window length, so the Myers loop has a compile-time trip
+/// count and the kernel touches no heap.
+pub fn levenshtein_fixed<const N: usize>(s1: &[u8; N], s2: &[u8; N]) -> u16 {
+    assert!(N <= u128::BITS as usize, "levenshtein_fixed supports windows of at most 128 bytes");
+    if N == 0 {
+        0
+    } else if N <= u64::BITS as usize {
+        myers_distance_u64(s1, s2)
+    } else {
+        myers_distance_u128(s1, s2)
+    }
+}
+
+/// Fixed-length variant of `levenshtein_batch` for windows of exactly `N`
+/// bytes (1 <= N <= 254, u8 lanes, whose cells would wrap at a distance of
+/// 255). The DP rows and the transposed targets
+/// live in stack arrays sized by `N`, and every loop bound is a compile-time
+/// constant, so each tier gets its own fully specialized kernel.
+pub fn levenshtein_batch_fixed<const N: usize>(query: &[u8; N], targets: &[&[u8; N]], out: &mut [u16]) {
+    assert!(N > 0 && N < u8::MAX as usize, "levenshtein_batch_fixed supports windows of 1 to 254 bytes");
+    levenshtein_batch_fixed_with_level(simd_level(), query, targets, out);
+}
+
+fn levenshtein_batch_fixed_with_level<const N: usize>(level: SimdLevel, query: &[u8; N], targets: &[&[u8; N]], out: &mut [u16]) {
+    assert_eq!(targets.len(), out.len(), "levenshtein_batch_fixed: output length must match target count");
+    match level {
+        SimdLevel::Scalar => {
+            for (target, dist) in targets.iter().zip(out.iter_mut()) {
+                *dist = if N % 2 == 0 && N <= FOUR_RUSSIANS_MAX_WINDOW {
+                    four_russians_table().distance::<N>(query, target)
+                } else if N <= u128::BITS as usize {
+                    levenshtein_fixed::<N>(query, target)
+                } else {
+                    levenshtein_distance(query, *target)
+                };
+            }
+        }
+        #[cfg(target_arch = "x86_64")]
+        SimdLevel::Sse41 => fixed_batch_in_chunks(query, targets, out, batch_fixed_sse41::<N>),
+        #[cfg(target_arch = "x86_64")]
+        SimdLevel::Avx2 => fixed_batch_in_chunks(query, targets, out, batch_fixed_avx2::<N>),
+        #[cfg(target_arch = "x86_64")]
+        SimdLevel::Avx512 => fixed_batch_in_chunks(query, targets, out, batch_fixed_avx512::<N>),
+        #[cfg(not(target_arch = "x86_64"))]
+        _ => unreachable!("SIMD batch kernels are only compiled for x86_64"),
+    }
+}
+
+#[cfg(target_arch = "x86_64")]
+fn fixed_batch_in_chunks<const N: usize, const LANES: usize>(
+    query: &[u8; N],
+    targets: &[&[u8; N]],
+    out: &mut [u16],
+    kernel: unsafe fn(&[u8; N], &[[u8; LANES]; N]) -> [u8; LANES],
+) {
+    for (chunk, chunk_out) in targets.chunks(LANES).zip(out.chunks_mut(LANES)) {
+        let mut columns = [[0u8; LANES]; N];
+        for (lane, target) in chunk.iter().enumerate() {
+            for (column, &c) in columns.iter_mut().zip(target.iter()) {
+                column[lane] = c;
+            }
+        }
+        // SAFETY: the kernel was selected by `simd_level`, which checked CPU support.
+        let result = unsafe { kernel(query, &columns) };
+        for (dist, &lane) in chunk_out.iter_mut().zip(result.iter()) {
+            *dist = lane as u16;
+        }
+    }
+}
+
+/// `batch_kernel` with the query length fixed at compile time. `rows[i]`
+/// holds D[i+1][j] for every lane; row 0 (D[0][j] = j) is shared by all lanes
+/// and never stored.
+#[inline(always)]
+fn batch_fixed_kernel<const N: usize, const LANES: usize>(query: &[u8; N], columns: &[[u8; LANES]; N]) -> [u8; LANES] {
+    let mut rows = [[0u8; LANES]; N];
+    for (i, row) in rows.iter_mut().enumerate() {
+        *row = [(i + 1) as u8; LANES];
+    }
+    for (j, column) in columns.iter().enumerate() {
+        let mut diag = [j as u8; LANES];
+        let mut left = [(j + 1) as u8; LANES];
+        for (slot, &q) in rows.iter_mut().zip(query.iter()) {
+            let up = *slot;
+            let mut cell = up;
+            for l in 0..LANES {
+                let substitution = diag[l].wrapping_add((column[l] != q) as u8);
+                cell[l] = substitution.min(up[l].wrapping_add(1)).min(left[l].wrapping_add(1));
+            }
+            diag = up;
+            left = cell;
+            *slot = cell;
+        }
+    }
+    rows[N - 1]
+}
+
+macro_rules! batch_fixed_kernel_for_isa {
+    ($name:ident, $feature:literal, $lanes:literal) => {
+        #[cfg(target_arch = "x86_64")]
+        #[target_feature(enable = $feature)]
+        unsafe fn $name<const N: usize>(query: &[u8; N], columns: &[[u8; $lanes]; N]) -> [u8; $lanes] {
+            batch_fixed_kernel::<N, $lanes>(query, columns)
+        }
+    };
+}
+
+batch_fixed_kernel_for_isa!(batch_fixed_sse41, "sse4.1", 16);
+batch_fixed_kernel_for_isa!(batch_fixed_avx2, "avx2", 32);
+batch_fixed_kernel_for_isa!(batch_fixed_avx512, "avx512bw", 64);
+
+/// Four-Russians block-transition table for 2x2 blocks of the DP matrix.
+/// A block's outputs depend only on which of its two query bytes equal which
+/// of its two text bytes (4 bits) and on the deltas entering along its top
+/// row and left column, each a pair of values in {-1, 0, +1} coded in base 3
+/// (0..9). An entry holds the bottom-row deltas (high byte, premultiplied by 9
+/// so it can be added straight into the next block row's index) and the
+/// right-column deltas (low byte) in the same coding, so a window of N bytes
+/// costs (N/2)^2 dependent lookups and no arithmetic on DP values at all.
+pub struct FourRussiansTable {
+    transitions: [u16; 16 * 9 * 9],
+}
+
+/// Widest window for which the (N/2)^2 table lookups of the Four-Russians
+/// kernel beat the scalar Myers kernel; the SIMD batch kernels beat both.
+const FOUR_RUSSIANS_MAX_WINDOW: usize = 16;
+
+/// Base-3 code of a delta pair with both entries +1 (the DP's outer borders).
+const FOUR_RUSSIANS_ALL_PLUS_ONE: u8 = 8;
+
+impl FourRussiansTable {
+    fn build() -> Self {
+        let decode = |code: usize| [(code / 3) as i8 - 1, (code % 3) as i8 - 1];
+        let encode = |pair: [i8; 2]| ((pair[0] + 1) * 3 + (pair[1] + 1)) as u16;
+
+        let mut transitions = [0u16; 16 * 9 * 9];
+        for eq_bits in 0..16 {
+            for top_code in 0..9 {
+                for left_code in 0..9 {
+                    // Solve the 3x3 corner-anchored block with the corner at 0.
+                    let top = decode(top_code);
+                    let left = decode(left_code);
+                    let mut d = [[0i8; 3]; 3];
+                    d[0][1] = top[0];
+                    d[0][2] = top[0] + top[1];
+                    d[1][0] = left[0];
+                    d[2][0] = left[0] + left[1];
+                    for i in 1..3 {
+                        for j in 1..3 {
+                            let mismatch = (eq_bits >> ((i - 1) * 2 + (j - 1)) & 1 == 0) as i8;
+                            d[i][j] = (d[i - 1][j - 1] + mismatch).min(d[i - 1][j] + 1).min(d[i][j - 1] + 1);
+                        }
+                    }
+                    let bottom = [d[2][1] - d[2][0], d[2][2] - d[2][1]];
+                    let right = [d[1][2] - d[0][2], d[2][2] - d[1][2]];
+                    transitions[(eq_bits * 9 + top_code) * 9 + left_code] = ((encode(bottom) * 9) << 8) | encode(right);
+                }
+            }
+        }
+        FourRussiansTable { transitions }
+    }
+
+    /// Distance between two windows of exactly `N` bytes (N even) using
+    /// (N/2)^2 table lookups.
+    pub fn distance<const N: usize>(&self, s1: &[u8; N], s2: &[u8; N]) -> u16 {
+        assert!(N % 2 == 0, "FourRussiansTable::distance needs an even window length");
+        // Horizontal deltas along the bottom of the previous block row, per
+        // block column, premultiplied by 9.
+        let mut top_offsets = [FOUR_RUSSIANS_ALL_PLUS_ONE as usize * 9; N];
+        for block_row in (0..N).step_by(2) {
+            let (a0, a1) = (s1[block_row], s1[block_row + 1]);
+            let mut left_code = FOUR_RUSSIANS_ALL_PLUS_ONE as usize;
+            for (block_col, top_offset) in (0..N).step_by(2).zip(top_offsets.iter_mut()) {
+                let (b0, b1) = (s2[block_col], s2[block_col + 1]);
+                let eq_bits = (a0 == b0) as usize | ((a0 == b1) as usize) << 1 | ((a1 == b0) as usize) << 2 | ((a1 == b1) as usize) << 3;
+                let entry = self.transitions[eq_bits * 81 + *top_offset + left_code];
+                *top_offset = (entry >> 8) as usize;
+                left_code = (entry & 0xff) as usize;
+            }
+        }
+        // D[N][N] = D[N][0] + the horizontal deltas along the bottom row.
+        let bottom_sum: i32 = top_offsets[..N / 2].iter().map(|&offset| (offset / 27) as i32 + (offset / 9 % 3) as i32 - 2).sum();
+        (N as i32 + bottom_sum) as u16
+    }
+}
+
+/// The process-wide Four-Russians table, built on first use.
+pub fn four_russians_table() -> &'static FourRussiansTable {
+    static TABLE: std::sync::OnceLock<FourRussiansTable> = std::sync::OnceLock::new();
+    TABLE.get_or_init(FourRussiansTable::build)
+}
+
+/// Reference row DP used to validate the bit-parallel kernels.
+/// Uses O(min(m,n)) space and O(m*n) time.
+#[cfg(test)]
+fn levenshtein_distance_dp(s1: &[u8], s2: &[u8]) -> u16 {
+    if s1.is_empty() { return s2.len() as u16; }
+    if s2.is_empty() { return s1.len() as u16; }
+
     // Ensure s1 is the shorter sequence for space optimization
     let (s1_effective, s2_effective) = if s1.len() <= s2.len() { (s1, s2) } else { (s2, s1) };
 
@@ -57,4 +966,261 @@ mod tests {
     fn test_levenshtein_order_invariant() {
         assert_eq!(levenshtein_distance(b"longstring", b"short"), levenshtein_distance(b"short", b"longstring"));
     }
-}
\ No newline at end of file
+
+    /// Deterministic pseudo-random DNA so kernel tests need no extra crates.
+    fn random_dna(seed: &mut u64, len: usize) -> Vec<u8> {
+        (0..len)
+            .map(|_| {
+                *seed = seed.wrapping_mul(6364136223846793005).wrapping_add(1442695040888963407);
+                b"ACGTN"[((*seed >> 33) % 5) as usize]
+            })
+            .collect()
+    }
+
+    #[test]
+    fn test_myers_word_kernels_match_dp() {
+        let mut seed = 42;
+        for &(len1, len2) in &[(1, 1), (10, 10), (10, 17), (63, 64), (64, 64), (64, 90), (65, 65), (100, 100), (128, 128), (127, 200)] {
+            for _ in 0..20 {
+                let a = random_dna(&mut seed, len1);
+                let b = random_dna(&mut seed, len2);
+                assert_eq!(levenshtein_distance(&a, &b), levenshtein_distance_dp(&a, &b), "lengths {}x{}", len1, len2);
+                assert_eq!(levenshtein_distance(&b, &a), levenshtein_distance_dp(&a, &b), "lengths {}x{}", len2, len1);
+            }
+        }
+    }
+
+    #[test]
+    fn test_myers_profile_matches_dp() {
+        let mut seed = 7;
+        for &(len1, len2) in &[(1, 5), (64, 64), (129, 129), (200, 150), (1000, 1000), (1000, 1003), (2100, 2100)] {
+            for _ in 0..3 {
+                let a = random_dna(&mut seed, len1);
+                let profile = MyersProfile::new(&a);
+                for _ in 0..3 {
+                    let b = random_dna(&mut seed, len2);
+                    assert_eq!(profile.distance(&b), levenshtein_distance_dp(&a, &b), "lengths {}x{}", len1, len2);
+                }
+            }
+        }
+        assert_eq!(MyersProfile::new(b"").distance(b"ACGT"), 4);
+        assert_eq!(MyersProfile::new(b"kitten").distance(b"sitting"), 3);
+    }
+
+    #[test]
+    fn test_myers_profile_bounded_matches_clamped_distance() {
+        let mut seed = 11;
+        for &(len1, len2) in &[(10, 10), (100, 100), (1000, 1000), (1000, 990), (300, 450), (2100, 2100)] {
+            let a = random_dna(&mut seed, len1);
+            let profile = MyersProfile::new(&a);
+            let mut near = a.clone();
+            for _ in 0..len1 / 40 {
+                let i = (random_dna(&mut seed, 1)[0] as usize * 7919 + near.len() / 3) % near.len();
+                near[i] = b'T';
+                near.remove((i * 31) % near.len());
+            }
+            near.resize(len2, b'G');
+            for b in [random_dna(&mut seed, len2), near, a.iter().copied().cycle().take(len2).collect()] {
+                let exact = levenshtein_distance_dp(&a, &b);
+                for &k in &[0u16, 1, 5, 20, 50, 100, 200, exact.saturating_sub(1), exact, exact + 1, 5000] {
+                    assert_eq!(profile.distance_bounded(&b, k), exact.min(k + 1), "lengths {}x{}, k={}, exact={}", len1, len2, k, exact);
+                }
+            }
+        }
+        assert_eq!(MyersProfile::new(b"").distance_bounded(b"ACGT", 2), 3);
+        assert_eq!(MyersProfile::new(b"kitten").distance_bounded(b"sitting", 3), 3);
+        assert_eq!(MyersProfile::new(b"kitten").distance_bounded(b"sitting", 2), 3);
+    }
+
+    fn supported_levels() -> Vec<SimdLevel> {
+        let mut levels = vec![SimdLevel::Scalar];
+        #[cfg(target_arch = "x86_64")]
+        {
+            if is_x86_feature_detected!("sse4.1") { levels.push(SimdLevel::Sse41); }
+            if is_x86_feature_detected!("avx2") { levels.push(SimdLevel::Avx2); }
+            if is_x86_feature_detected!("avx512bw") { levels.push(SimdLevel::Avx512); }
+        }
+        levels
+    }
+
+    #[test]
+    fn test_levenshtein_batch_matches_scalar_on_every_level() {
+        let levels = supported_levels();
+
+        let mut seed = 99;
+        for &(query_len, target_len, count) in &[(10, 10, 100), (100, 100, 37), (100, 90, 5), (300, 300, 9), (0, 4, 3)] {
+            let query = random_dna(&mut seed, query_len);
+            let owned: Vec<Vec<u8>> = (0..count).map(|_| random_dna(&mut seed, target_len)).collect();
+            let targets: Vec<&[u8]> = owned.iter().map(|t| t.as_slice()).collect();
+            let expected: Vec<u16> = targets.iter().map(|t| levenshtein_distance_dp(&query, t)).collect();
+            for &level in &levels {
+                let mut out = vec![0u16; count];
+                levenshtein_batch_with_level(level, &query, &targets, &mut out);
+                assert_eq!(out, expected, "{} with {}x{}", level.name(), query_len, target_len);
+            }
+        }
+
+        // Disjoint alphabets reach the largest distance, which u8 lanes hold only below 255.
+        for len in [254, 255] {
+            let query = vec![b'A'; len];
+            let target = vec![b'C'; len];
+            for &level in &levels {
+                let mut out = vec![0u16; 3];
+                levenshtein_batch_with_level(level, &query, &[&target[..]; 3], &mut out);
+                assert_eq!(out, vec![len as u16; 3], "{} with {}x{}", level.name(), len, len);
+            }
+        }
+
+        let mixed: Vec<&[u8]> = vec![b"ACGT", b"AC", b"ACGTACGT"];
+        let mut out = vec![0u16; 3];
+        levenshtein_batch(b"ACGA", &mixed, &mut out);
+        assert_eq!(out, vec![1, 2, 4]);
+    }
+
+    #[test]
+    fn test_fixed_kernels_match_dp() {
+        fn check<const N: usize>(seed: &mut u64, levels: &[SimdLevel]) {
+            let query: [u8; N] = random_dna(seed, N).try_into().unwrap();
+            let owned: Vec<[u8; N]> = (0..77).map(|_| random_dna(seed, N).try_into().unwrap()).collect();
+            let targets: Vec<&[u8; N]> = owned.iter().collect();
+            let expected: Vec<u16> = owned.iter().map(|t| levenshtein_distance_dp(&query, t)).collect();
+            for t in &owned {
+                if N <= 128 {
+                    assert_eq!(levenshtein_fixed::<N>(&query, t), levenshtein_distance_dp(&query, t));
+                }
+            }
+            for &level in levels {
+                let mut out = vec![0u16; targets.len()];
+                levenshtein_batch_fixed_with_level(level, &query, &targets, &mut out);
+                assert_eq!(out, expected, "{} with N={}", level.name(), N);
+            }
+        }
+
+        let levels = supported_levels();
+        let mut seed = 3;
+        check::<1>(&mut seed, &levels);
+        check::<10>(&mut seed, &levels);
+        check::<64>(&mut seed, &levels);
+        check::<100>(&mut seed, &levels);
+        check::<200>(&mut seed, &levels);
+
+        // Disjoint alphabets reach the largest distance the u8 lanes hold.
+        let (query, target) = ([b'A'; 254], [b'C'; 254]);
+        for &level in &levels {
+            let mut out = vec![0u16; 3];
+            levenshtein_batch_fixed_with_level(level, &query, &[&target; 3], &mut out);
+            assert_eq!(out, vec![254; 3], "{} with N=254", level.name());
+        }
+    }
+
+    #[test]
+    #[should_panic(expected = "windows of 1 to 254 bytes")]
+    fn test_fixed_kernels_reject_255_byte_windows() {
+        levenshtein_batch_fixed(&[b'A'; 255], &[&[b'C'; 255]], &mut [0]);
+    }
+
+    #[test]
+    fn test_diagonal_transition_matches_dp() {
+        let mut seed = 5;
+        for &len in &[0usize, 1, 7, 10, 100, 1000] {
+            for trial in 0..40 {
+                let a = random_dna(&mut seed, len);
+                let mut b = a.clone();
+                for e in 0..trial % 12 {
+                    let r = random_dna(&mut seed, 2);
+                    let pos = (r[0] as usize * 131 + e * 977 + trial * 13) % (b.len() + 1);
+                    match (r[1] as usize + e) % 3 {
+                        0 if pos < b.len() => b[pos] = r[0],
+                        1 if pos < b.len() => { b.remove(pos); }
+                        _ => b.insert(pos, r[1]),
+                    }
+                }
+                let exact = levenshtein_distance_dp(&a, &b);
+                for &cap in &[0usize, 1, 3, 8, 20, 64] {
+                    let expected = if exact as usize <= cap { Some(exact) } else { None };
+                    assert_eq!(diagonal_transition_distance(&a, &b, cap), expected, "len {} cap {}", len, cap);
+                }
+                assert!(hamming_upper_bound(&a, &b) >= exact as usize);
+                let profile = MyersProfile::new(&a);
+                assert_eq!(profile.distance_adaptive(&b), exact);
+            }
+        }
+        assert_eq!(hamming_upper_bound(b"ACGTACGTACGT", b"ACGAACGTACGA"), 2);
+        assert_eq!(diagonal_transition_distance(b"kitten", b"sitting", 3), Some(3));
+    }
+
+    #[test]
+    fn test_prefix_distances_match_dp() {
+        let mut seed = 21;
+        let a = random_dna(&mut seed, 1000);
+        let profile = MyersProfile::new(&a);
+        let mut similar = a.clone();
+        similar[5] = b'N';
+        similar.remove(50);
+        similar.insert(400, b'A');
+        for b in [random_dna(&mut seed, 1000), similar, a.clone()] {
+            let lens = [0, 10, 64, 100, 128, 1000];
+            let mut out = [0u16; 6];
+            profile.prefix_distances(&b, &lens, &mut out);
+            for (&len, &dist) in lens.iter().zip(out.iter()) {
+                assert_eq!(dist, levenshtein_distance_dp(&a[..len], &b[..len]), "prefix {}", len);
+            }
+        }
+        let mut out = [0u16; 2];
+        profile.prefix_distances(&a[..100], &[10, 100], &mut out);
+        assert_eq!(out, [0, 0]);
+    }
+
+    #[test]
+    fn test_bound_cascade() {
+        let comp = |s: &[u8]| BaseComposition::of(s);
+        let cascade = |s1: &[u8], s2: &[u8], k| bound_cascade(&comp(s1), &comp(s2), k, || hamming_upper_bound(s1, s2));
+        assert_eq!(cascade(b"ACGTACGT", b"ACGTACGT", None), BoundOutcome::Identical);
+        // One substitution shifts one count: both bounds are 1.
+        assert_eq!(cascade(b"ACGTACGT", b"ACGTACGA", None), BoundOutcome::BoundsMet(1));
+        // A rotation keeps the composition but mismatches everywhere.
+        assert_eq!(cascade(b"ACGTACGT", b"CGTACGTA", None), BoundOutcome::NeedsDp);
+        assert_eq!(cascade(b"AAAAAAAA", b"CCCCCCCC", Some(4)), BoundOutcome::AboveThreshold);
+        assert_eq!(cascade(b"AAAAAAAA", b"CCCCCCCC", Some(8)), BoundOutcome::BoundsMet(8));
+
+        let mut seed = 11u64;
+        for round in 0..200usize {
+            let s1 = random_dna(&mut seed, 40 + round % 30);
+            let mut s2 = s1.clone();
+            s2[round % 40] = b'A';
+            if round % 3 == 0 {
+                s2 = random_dna(&mut seed, s1.len());
+            }
+            let exact = levenshtein_distance_dp(&s1, &s2);
+            assert!(comp(&s1).lower_bound(&comp(&s2)) <= exact as usize);
+            match cascade(&s1, &s2, None) {
+                BoundOutcome::Identical => assert_eq!(exact, 0),
+                BoundOutcome::BoundsMet(d) => assert_eq!(d, exact),
+                BoundOutcome::NeedsDp => {}
+                BoundOutcome::AboveThreshold => unreachable!(),
+            }
+        }
+    }
+
+    #[test]
+    fn test_four_russians_matches_dp() {
+        fn check<const N: usize>(seed: &mut u64) {
+            let table = four_russians_table();
+            for _ in 0..500 {
+                let a: [u8; N] = random_dna(seed, N).try_into().unwrap();
+                let mut b: [u8; N] = random_dna(seed, N).try_into().unwrap();
+                if seed.count_ones() % 2 == 0 {
+                    b = a;
+                    b[(*seed as usize) % N] = b'N';
+                }
+                assert_eq!(table.distance(&a, &b), levenshtein_distance_dp(&a, &b));
+            }
+        }
+        let mut seed = 17;
+        check::<2>(&mut seed);
+        check::<10>(&mut seed);
+        check::<64>(&mut seed);
+        assert_eq!(four_russians_table().distance(b"ACGTACGTAC", b"ACGTACGTAC"), 0);
+        assert_eq!(four_russians_table().distance(b"AAAAAAAAAA", b"CCCCCCCCCC"), 10);
+    }
+}
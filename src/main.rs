@@ -1,16 +1,29 @@
+mod bgzf;
+mod cli;
+mod dedup;
+mod fasta_index;
 mod fasta_parser;
+mod genome;
 mod levenshtein;
-
-use arrow::array::{ArrayRef, PrimitiveArray, StringBuilder};
-use arrow::datatypes::{DataType, Field, Schema, UInt16Type, UInt32Type, UInt8Type};
+mod matrix;
+mod output;
+mod packed;
+mod prefetch;
+mod schedule;
+mod twobit;
+mod windows;
+
+use arrow::array::{ArrayRef, StringArray};
+use arrow::datatypes::{DataType, Field, Schema, SchemaRef};
 use arrow::error::Result as ArrowResult; 
-use arrow::ipc::writer::FileWriter;
-use arrow::record_batch::RecordBatch;
 
-use crossbeam_channel::bounded;
+use crossbeam_channel::{bounded, Sender};
 use rayon::prelude::*;
+use std::collections::HashMap;
 use std::fs::File;
 use std::io::BufWriter;
+use std::ops::Range;
+use std::sync::atomic::{AtomicBool, AtomicU64, AtomicUsize, Ordering};
 use std::sync::Arc;
 use std::thread;
 
@@ -21,13 +34,48 @@ const CHUNK_SIZE_2: usize = 100;
 const DIST_THRESHOLD_1: usize = 100_000;
 const DIST_THRESHOLD_2: usize = 1_000_000;
 
+/// Window length of each tier, indexed by the `type` value. Every window starts
+/// at its grid point, so each one is a prefix of the next.
+const TIER_WINDOW_LENS: [usize; cli::NUM_TIERS] = [CHUNK_SIZE_1, CHUNK_SIZE_2, GRID_SPACING];
+
+/// Largest idx2 - idx1 of each tier but the last, in grid points.
+const TIER_MAX_GRID_OFFSETS: [usize; cli::NUM_TIERS - 1] = [DIST_THRESHOLD_1 / GRID_SPACING, DIST_THRESHOLD_2 / GRID_SPACING];
+
+/// Rough relative cost of one pair in each tier, for tile scheduling: the near
+/// tiers go through SIMD batch kernels, the far tier through a 1 kb Myers DP.
+const TIER_PAIR_COSTS: [u64; cli::NUM_TIERS] = [1, 5, 500];
+
 const ARROW_BATCH_SIZE: usize = 1 << 16;
 
+/// Rows of a batch in Parquet mode, where every batch is written as one row group.
+const PARQUET_ROW_GROUP_ROWS: usize = 1 << 19;
+
+/// Bases loaded and scheduled together: one schedule covers a wave, and memory
+/// holds the waves being computed (or one longer chromosome) plus the
+/// prefetched ones. A wave's tasks overlap the next wave's, so the pool does
+/// not drain between them.
+const WAVE_BASES: usize = 256_000_000;
+
+/// Upper bound on the far-tier class pairs remembered per wave (about 100 MB),
+/// shared out among the wave's chromosomes by size; pairs beyond it are simply
+/// recomputed.
+const FAR_PAIR_CACHE_CAPACITY: usize = 1 << 22;
+
 struct DistanceDataBatch {
     idx1: Vec<u32>,
     idx2: Vec<u32>,
     dist_val: Vec<u16>,
     dist_type: Vec<u8>,
+    /// All-tiers mode: one distance column per reported tier; `dist_val` and
+    /// `dist_type` stay empty.
+    tier_dist_vals: Vec<Vec<u16>>,
+    /// Compact mode: the tier of every run in the batch. `idx1` and `idx2`
+    /// then hold the row and first idx2 offset of each run, and `dist_val`
+    /// its distances, ending at the matching `run_ends` entry (after a 0).
+    compact_tier: Option<u8>,
+    run_ends: Vec<i32>,
+    /// Rows (runs in compact mode) or distances at which the batch is full.
+    max_rows: usize,
 }
 
 impl DistanceDataBatch {
@@ -37,9 +85,44 @@ impl DistanceDataBatch {
             idx2: Vec::with_capacity(ARROW_BATCH_SIZE),
             dist_val: Vec::with_capacity(ARROW_BATCH_SIZE),
             dist_type: Vec::with_capacity(ARROW_BATCH_SIZE),
+            tier_dist_vals: Vec::new(),
+            compact_tier: None,
+            run_ends: Vec::new(),
+            max_rows: ARROW_BATCH_SIZE,
         }
     }
 
+    fn with_tier_columns(num_tiers: usize) -> Self {
+        DistanceDataBatch {
+            idx1: Vec::with_capacity(ARROW_BATCH_SIZE),
+            idx2: Vec::with_capacity(ARROW_BATCH_SIZE),
+            dist_val: Vec::new(),
+            dist_type: Vec::new(),
+            tier_dist_vals: (0..num_tiers).map(|_| Vec::with_capacity(ARROW_BATCH_SIZE)).collect(),
+            compact_tier: None,
+            run_ends: Vec::new(),
+            max_rows: ARROW_BATCH_SIZE,
+        }
+    }
+
+    fn for_tier_runs(tier: u8) -> Self {
+        DistanceDataBatch {
+            idx1: Vec::new(),
+            idx2: Vec::new(),
+            dist_val: Vec::with_capacity(ARROW_BATCH_SIZE),
+            dist_type: Vec::new(),
+            tier_dist_vals: Vec::new(),
+            compact_tier: Some(tier),
+            run_ends: vec![0],
+            max_rows: ARROW_BATCH_SIZE,
+        }
+    }
+
+    fn with_max_rows(mut self, max_rows: usize) -> Self {
+        self.max_rows = max_rows;
+        self
+    }
+
     fn add(&mut self, i1: u32, i2: u32, dv: u16, dt: u8) {
         self.idx1.push(i1);
         self.idx2.push(i2);
@@ -47,8 +130,24 @@ impl DistanceDataBatch {
         self.dist_type.push(dt);
     }
 
+    fn add_tiers(&mut self, i1: u32, i2: u32, dvs: &[u16]) {
+        self.idx1.push(i1);
+        self.idx2.push(i2);
+        for (column, &dv) in self.tier_dist_vals.iter_mut().zip(dvs) {
+            column.push(dv);
+        }
+    }
+
+    /// Adds the pairs of row `i1` from `first_i2` on, all of one tier, as a single run.
+    fn add_run(&mut self, i1: u32, first_i2: u32, dvs: &[u16]) {
+        self.idx1.push(i1);
+        self.idx2.push(first_i2 - i1);
+        self.dist_val.extend_from_slice(dvs);
+        self.run_ends.push(self.dist_val.len() as i32);
+    }
+
     fn is_full(&self) -> bool {
-        self.idx1.len() >= ARROW_BATCH_SIZE
+        self.idx1.len() >= self.max_rows || self.dist_val.len() >= self.max_rows
     }
 
     fn is_empty(&self) -> bool {
@@ -65,89 +164,338 @@ impl std::fmt::Display for ChannelSendError {
 }
 impl std::error::Error for ChannelSendError {}
 
+/// Far-tier pairs settled by each stage of the bound cascade, summed over rows.
+#[derive(Default)]
+struct CascadeCounters {
+    above_threshold: AtomicU64,
+    identical: AtomicU64,
+    bounds_met: AtomicU64,
+    dp: AtomicU64,
+}
 
-fn main() -> Result<(), Box<dyn std::error::Error>> {
-    let mut args = std::env::args();
-    args.next();
-    let fasta_path = args.next().ok_or_else(|| "Usage: program <fasta_file> <output_ipc_file> (missing fasta_file)".to_string())?;
-    let output_path = args.next().ok_or_else(|| "Usage: program <fasta_file> <output_ipc_file> (missing output_ipc_file)".to_string())?;
+impl CascadeCounters {
+    /// Adds one row's counts, indexed like the fields.
+    fn add_row(&self, row_counts: [u64; 4]) {
+        let counters = [&self.above_threshold, &self.identical, &self.bounds_met, &self.dp];
+        for (counter, count) in counters.iter().zip(row_counts) {
+            if count > 0 {
+                counter.fetch_add(count, Ordering::Relaxed);
+            }
+        }
+    }
+}
 
-    println!("Loading chromosome sequences from: {}", fasta_path);
-    let all_chromosomes = fasta_parser::load_chromosomes(&fasta_path)
-        .map_err(|e| format!("Failed to load FASTA file '{}': {}", fasta_path, e))?;
+/// A chromosome with everything its pairs need, shared by all tasks that
+/// cover part of its triangle.
+struct ChromosomeJob {
+    name: String,
+    num_grid_points: usize,
+    /// Dense windows of the near tiers (none in all-tiers mode).
+    near_windows: Vec<windows::TierWindows>,
+    /// Full grid windows, read from the packed chromosome.
+    far_windows: windows::PackedWindows,
+    /// Window classes of every tier this run reads, nearest tier first.
+    window_classes: Vec<dedup::WindowClasses>,
+    /// Base composition of every full grid window, for the far-tier lower bound.
+    far_compositions: Vec<levenshtein::BaseComposition>,
+    far_pair_cache: dedup::PairCache,
+    cascade_counters: CascadeCounters,
+    /// Tasks of this job still running or queued; the job is done at zero.
+    remaining_tasks: AtomicUsize,
+}
 
-    if all_chromosomes.is_empty() {
-        println!("No chromosome sequences loaded from {}. Exiting.", fasta_path);
-        return Ok(());
+impl ChromosomeJob {
+    /// Gathers the windows of every tier this run reads (only the full grid
+    /// window in all-tiers mode) and classifies them for exact deduplication.
+    fn new(name: String, sequence: Arc<packed::PackedSequence>, offset: usize, num_grid_points: usize, all_tiers: bool,
+           far_pair_cache_capacity: usize) -> Self {
+        let near_window_lens: &[usize] = if all_tiers { &[] } else { &TIER_WINDOW_LENS[..cli::NUM_TIERS - 1] };
+        let near_windows: Vec<windows::TierWindows> = near_window_lens
+            .par_iter()
+            .map(|&window_len| windows::TierWindows::new(&sequence, offset, num_grid_points, GRID_SPACING, window_len))
+            .collect();
+        let far_windows = windows::PackedWindows::new(sequence, offset, GRID_SPACING, GRID_SPACING);
+        let mut window_classes: Vec<dedup::WindowClasses> = near_windows
+            .par_iter()
+            .map(|windows| dedup::WindowClasses::new(windows.data(), num_grid_points, windows.window_len(), windows.window_len()))
+            .collect();
+        window_classes.push(dedup::WindowClasses::from_keys((0..num_grid_points).map(|idx| far_windows.class_key(idx))));
+        let window_lens = near_window_lens.iter().chain(&TIER_WINDOW_LENS[cli::NUM_TIERS - 1..]);
+        for (window_len, classes) in window_lens.zip(&window_classes) {
+            println!("  {} bp windows: {} distinct, {} all-N.", window_len, classes.num_sequence_classes(), classes.num_all_n_windows());
+        }
+        let far_compositions: Vec<levenshtein::BaseComposition> = if all_tiers {
+            Vec::new()
+        } else {
+            (0..num_grid_points)
+                .into_par_iter()
+                .map_init(Vec::new, |window, idx| {
+                    far_windows.unpack_into(idx, window);
+                    levenshtein::BaseComposition::of(window)
+                })
+                .collect()
+        };
+        ChromosomeJob {
+            name,
+            num_grid_points,
+            near_windows,
+            far_windows,
+            window_classes,
+            far_compositions,
+            far_pair_cache: dedup::PairCache::new(far_pair_cache_capacity),
+            cascade_counters: CascadeCounters::default(),
+            remaining_tasks: AtomicUsize::new(0),
+        }
     }
-    println!("Loaded {} chromosome sequence(s).", all_chromosomes.len());
 
-    let schema = Arc::new(Schema::new(vec![
-        Field::new("chromosome", DataType::Utf8, false),
-        Field::new("idx1", DataType::UInt32, false),
-        Field::new("idx2", DataType::UInt32, false),
-        Field::new("distance", DataType::UInt16, false),
-        Field::new("type", DataType::UInt8, false),
-    ]));
+    /// Distances between grid point idx1 and every grid point of idx2_range: one value per pair, or one
+    /// per reported tier in all-tiers mode, in idx2 order.
+    fn compute_row_segment(&self, planner: &mut dedup::RowPlanner, idx1: usize, idx2_range: Range<usize>,
+                           tier_prefix_lens: Option<&[usize]>, max_distance: Option<u16>) -> Vec<u16> {
+        let mut row_distances: Vec<u16>;
+        if let Some(prefix_lens) = tier_prefix_lens {
+            // Identical full windows have identical prefixes, so the full-window classes cover every tier.
+            let classes = &self.window_classes[self.window_classes.len() - 1];
+            planner.plan(classes, idx1, idx2_range.clone(), None);
+            let mut representative_distances = vec![0u16; planner.representatives.len() * prefix_lens.len()];
+            if !planner.representatives.is_empty() {
+                let (mut seq1, mut seq2) = (Vec::new(), Vec::new());
+                self.far_windows.unpack_into(idx1, &mut seq1);
+                let profile = levenshtein::MyersProfile::new(&seq1);
+                for (&idx2, pair_distances) in planner.representatives.iter().zip(representative_distances.chunks_exact_mut(prefix_lens.len())) {
+                    self.far_windows.unpack_into(idx2, &mut seq2);
+                    profile.prefix_distances(&seq2, prefix_lens, pair_distances);
+                }
+            }
+            let query_is_gap = classes.class(idx1) == dedup::ALL_N_CLASS;
+            row_distances = Vec::with_capacity(idx2_range.len() * prefix_lens.len());
+            for (idx2, source) in idx2_range.zip(&planner.sources) {
+                match *source {
+                    dedup::PairSource::Representative(slot) => {
+                        let start = slot as usize * prefix_lens.len();
+                        row_distances.extend_from_slice(&representative_distances[start..start + prefix_lens.len()]);
+                    }
+                    dedup::PairSource::AllN => {
+                        let other = if query_is_gap { idx2 } else { idx1 };
+                        row_distances.extend(prefix_lens.iter().map(|&len| self.far_windows.non_n_bases(other, len) as u16));
+                    }
+                    dedup::PairSource::Identical => {
+                        row_distances.extend(std::iter::repeat(0).take(prefix_lens.len()));
+                    }
+                    dedup::PairSource::Cached(_) => {
+                        unreachable!("all-tiers rows are planned without a pair cache, which holds one distance per pair");
+                    }
+                }
+            }
+        } else {
+            // Tiers occupy contiguous idx2 ranges of the row, nearest first.
+            let tier0_end = (idx1 + DIST_THRESHOLD_1 / GRID_SPACING + 1).min(self.num_grid_points);
+            let tier1_end = (idx1 + DIST_THRESHOLD_2 / GRID_SPACING + 1).min(self.num_grid_points);
+            let in_segment = |tier_range: Range<usize>| {
+                let start = tier_range.start.max(idx2_range.start);
+                start..tier_range.end.min(idx2_range.end).max(start)
+            };
 
-    let file = File::create(&output_path)
-        .map_err(|e| format!("Failed to create output file '{}': {}", output_path, e))?;
-    let buf_writer = BufWriter::with_capacity(128 * 1024, file);
-    let mut arrow_writer = FileWriter::try_new(buf_writer, &schema)?;
+            row_distances = Vec::with_capacity(idx2_range.len());
+            let [tier0_windows, tier1_windows] = &self.near_windows[..] else {
+                unreachable!("near tiers are gathered outside all-tiers mode");
+            };
+            extend_with_tier(&self.window_classes[0], |idx| dedup::all_n_distance(tier0_windows.window(idx)),
+                             idx1, in_segment(idx1 + 1..tier0_end), None, planner, &mut row_distances,
+                             |idx2s, out| near_tier_distances::<CHUNK_SIZE_1>(tier0_windows, idx1, idx2s, out));
+            extend_with_tier(&self.window_classes[1], |idx| dedup::all_n_distance(tier1_windows.window(idx)),
+                             idx1, in_segment(tier0_end..tier1_end), None, planner, &mut row_distances,
+                             |idx2s, out| near_tier_distances::<CHUNK_SIZE_2>(tier1_windows, idx1, idx2s, out));
+
+            // Far pairs all compare the same seq1, so its Myers profile is built once per row segment, and
+            // only for pairs the bound cascade cannot settle. Far kernels are slow enough that class pairs
+            // are also shared across rows.
+            // The cascade compares packed windows; only pairs that need the DP are unpacked.
+            let far_windows = &self.far_windows;
+            extend_with_tier(&self.window_classes[2], |idx| far_windows.non_n_bases(idx, GRID_SPACING) as u16,
+                             idx1, in_segment(tier1_end..self.num_grid_points), Some(&self.far_pair_cache), planner, &mut row_distances,
+                             |idx2s, out| {
+                let (mut seq1, mut seq2) = (Vec::new(), Vec::new());
+                let mut far_profile = None;
+                let mut row_counts = [0u64; 4];
+                for (&idx2, dist) in idx2s.iter().zip(out.iter_mut()) {
+                    let hamming = || far_windows.hamming(idx1, idx2);
+                    *dist = match levenshtein::bound_cascade(&self.far_compositions[idx1], &self.far_compositions[idx2], max_distance, hamming) {
+                        levenshtein::BoundOutcome::AboveThreshold => {
+                            row_counts[0] += 1;
+                            max_distance.map_or(u16::MAX, |k| k + 1)
+                        }
+                        levenshtein::BoundOutcome::Identical => {
+                            row_counts[1] += 1;
+                            0
+                        }
+                        levenshtein::BoundOutcome::BoundsMet(bound) => {
+                            row_counts[2] += 1;
+                            bound
+                        }
+                        levenshtein::BoundOutcome::NeedsDp => {
+                            row_counts[3] += 1;
+                            let profile = far_profile.get_or_insert_with(|| {
+                                far_windows.unpack_into(idx1, &mut seq1);
+                                levenshtein::MyersProfile::new(&seq1)
+                            });
+                            far_windows.unpack_into(idx2, &mut seq2);
+                            match max_distance {
+                                Some(k) => profile.distance_bounded(&seq2, k),
+                                None => profile.distance_adaptive(&seq2),
+                            }
+                        }
+                    };
+                }
+                self.cascade_counters.add_row(row_counts);
+            });
+        }
+        if let Some(k) = max_distance {
+            for dist in row_distances.iter_mut() {
+                *dist = (*dist).min(k + 1);
+            }
+        }
+        row_distances
+    }
 
+    fn report_finished(&self) {
+        println!("Successfully finished processing chromosome: {}", self.name);
+        let cascade_counts = [&self.cascade_counters.above_threshold, &self.cascade_counters.identical,
+                              &self.cascade_counters.bounds_met, &self.cascade_counters.dp]
+            .map(|counter| counter.load(Ordering::Relaxed));
+        if cascade_counts.iter().any(|&count| count > 0) {
+            println!("  Far-tier bound cascade: {} above threshold, {} identical, {} settled by bounds, {} computed by DP.",
+                     cascade_counts[0], cascade_counts[1], cascade_counts[2], cascade_counts[3]);
+        }
+        if self.far_pair_cache.len() > 0 {
+            println!("  Far-tier pair cache held {} repeated class pairs.", self.far_pair_cache.len());
+        }
+    }
+}
 
-    let num_threads_for_pool = num_cpus::get();
-    println!("Using Rayon thread pool with up to {} threads for computation.", num_threads_for_pool);
+/// Window length and `type` tag for a pair of grid points `grid_offset` apart.
+fn tier_for_grid_offset(grid_offset: usize) -> (usize, u8) {
+    let genome_dist = grid_offset * GRID_SPACING;
+    if genome_dist <= DIST_THRESHOLD_1 {
+        (CHUNK_SIZE_1, 0u8)
+    } else if genome_dist <= DIST_THRESHOLD_2 {
+        (CHUNK_SIZE_2, 1u8)
+    } else {
+        (GRID_SPACING, 2u8)
+    }
+}
 
-    let (tx, rx) = bounded::<(String, DistanceDataBatch)>(num_threads_for_pool.max(1) * 2);
+/// Splits the pairs of row `idx1` with grid points `idx2_range` into one run
+/// per tier they reach, as tiers occupy contiguous idx2 ranges of a row.
+fn tier_runs(idx1: usize, idx2_range: Range<usize>) -> impl Iterator<Item = (u8, Range<usize>)> {
+    let mut run_start = idx2_range.start;
+    std::iter::from_fn(move || {
+        if run_start >= idx2_range.end {
+            return None;
+        }
+        let (_, tier) = tier_for_grid_offset(run_start - idx1);
+        let run_end = TIER_MAX_GRID_OFFSETS.get(tier as usize)
+            .map_or(idx2_range.end, |&max_offset| (idx1 + max_offset + 1).min(idx2_range.end));
+        let run = run_start..run_end;
+        run_start = run_end;
+        Some((tier, run))
+    })
+}
 
-    let writer_thread_schema = schema.clone();
-    let writer_thread = thread::spawn(move || -> ArrowResult<()> {
-        let mut batches_written = 0;
-        let mut total_rows_written = 0;
-        loop {
-            match rx.recv() {
-                Ok((chrom_name_for_batch, mut batch_data)) => {
-                    let num_rows = batch_data.idx1.len();
-                    if num_rows == 0 { continue; }
+/// Type of the distances of `tier` in compact mode: u8 whenever the window
+/// length, or the threshold, keeps them under 256.
+fn compact_distance_type(tier: usize, max_distance: Option<u16>) -> DataType {
+    let largest = max_distance.map_or(TIER_WINDOW_LENS[tier], |k| TIER_WINDOW_LENS[tier].min(k as usize + 1));
+    if largest <= u8::MAX as usize { DataType::UInt8 } else { DataType::UInt16 }
+}
 
-                    let mut chrom_name_builder = StringBuilder::new();
-                    for _ in 0..num_rows {
-                        chrom_name_builder.append_value(&chrom_name_for_batch);
-                    }
-                    let col_chrom_name: ArrayRef = Arc::new(chrom_name_builder.finish());
-
-                    let col_idx1: ArrayRef = Arc::new(PrimitiveArray::<UInt32Type>::from(std::mem::take(&mut batch_data.idx1)));
-                    let col_idx2: ArrayRef = Arc::new(PrimitiveArray::<UInt32Type>::from(std::mem::take(&mut batch_data.idx2)));
-                    let col_dist_val: ArrayRef = Arc::new(PrimitiveArray::<UInt16Type>::from(std::mem::take(&mut batch_data.dist_val)));
-                    let col_dist_type: ArrayRef = Arc::new(PrimitiveArray::<UInt8Type>::from(std::mem::take(&mut batch_data.dist_type)));
-
-                    let record_batch = RecordBatch::try_new(
-                        writer_thread_schema.clone(),
-                        vec![col_chrom_name, col_idx1, col_idx2, col_dist_val, col_dist_type],
-                    )?;
-                    arrow_writer.write(&record_batch)?;
-                    batches_written += 1;
-                    total_rows_written += num_rows;
-                    if batches_written % 100 == 0 {
-                        println!("Writer thread: Written {} batches ({} rows total) to IPC file.", batches_written, total_rows_written);
-                    }
-                }
-                Err(_) => {
-                    println!("Writer thread: All data received. Finalizing Arrow file.");
-                    arrow_writer.finish()?;
-                    println!("Writer thread: Arrow file finished. Total batches written: {}, total rows: {}.", batches_written, total_rows_written);
-                    break Ok(());
-                }
-            }
+/// Output path of one tier in compact mode: `out.arrow` becomes `out.tier0.arrow`.
+fn compact_tier_path(output_path: &str, tier: usize) -> String {
+    let path = std::path::Path::new(output_path);
+    let extension = match path.extension() {
+        Some(extension) => format!("tier{}.{}", tier, extension.to_string_lossy()),
+        None => format!("tier{}", tier),
+    };
+    path.with_extension(extension).to_string_lossy().into_owned()
+}
+
+/// Computes the distances between the `N`-bp window of grid point `idx1` and
+/// the window of every grid point in `idx2s`. Near-tier windows all share one
+/// length, so up to 254 bp, where every distance fits a u8 lane, they all go
+/// through the SIMD batch kernel specialized for `N`.
+fn near_tier_distances<const N: usize>(windows: &windows::TierWindows, idx1: usize, idx2s: &[usize], out: &mut [u16]) {
+    if N < u8::MAX as usize {
+        let targets: Vec<&[u8; N]> = idx2s.iter().map(|&idx2| windows.fixed_window::<N>(idx2)).collect();
+        levenshtein::levenshtein_batch_fixed(windows.fixed_window::<N>(idx1), &targets, out);
+    } else {
+        let targets: Vec<&[u8]> = idx2s.iter().map(|&idx2| windows.window(idx2)).collect();
+        levenshtein::levenshtein_batch(windows.window(idx1), &targets, out);
+    }
+}
+
+/// Appends the distances between grid point `idx1` and every grid point of
+/// `idx2_range` in one tier. Pairs are resolved through the tier's window
+/// classes, and only one representative per distinct class goes through
+/// `kernel`, which fills the distances of the grid points it is given.
+/// `non_n_bases` counts the non-`N` bases of the window at a grid point.
+fn extend_with_tier(
+    classes: &dedup::WindowClasses,
+    non_n_bases: impl Fn(usize) -> u16,
+    idx1: usize,
+    idx2_range: Range<usize>,
+    cache: Option<&dedup::PairCache>,
+    planner: &mut dedup::RowPlanner,
+    row_distances: &mut Vec<u16>,
+    kernel: impl FnOnce(&[usize], &mut [u16]),
+) {
+    planner.plan(classes, idx1, idx2_range, cache);
+    let mut representative_distances = vec![0u16; planner.representatives.len()];
+    if !planner.representatives.is_empty() {
+        kernel(&planner.representatives, &mut representative_distances);
+        if let Some(cache) = cache {
+            planner.remember(classes, &representative_distances, cache);
         }
-    });
+    }
+    // Exactly one window of an all-N pair is a gap; its distance comes from the other one.
+    let query_is_gap = classes.class(idx1) == dedup::ALL_N_CLASS;
+    planner.fan_out(&representative_distances, |idx2| {
+        non_n_bases(if query_is_gap { idx2 } else { idx1 })
+    }, row_distances);
+}
 
-    for (chrom_name, chrom_sequence_data) in all_chromosomes {
-        println!("Processing chromosome: {} (length: {} bp)", chrom_name, chrom_sequence_data.len());
+/// Empty batches of the layout of each output file, of up to `max_rows`
+/// rows: one per tier in compact mode, a single one otherwise.
+fn new_batches(tier_prefix_lens: Option<&[usize]>, compact: bool, max_rows: usize) -> Vec<DistanceDataBatch> {
+    let batches = match tier_prefix_lens {
+        Some(prefix_lens) => vec![DistanceDataBatch::with_tier_columns(prefix_lens.len())],
+        None if compact => (0..cli::NUM_TIERS).map(|tier| DistanceDataBatch::for_tier_runs(tier as u8)).collect(),
+        None => vec![DistanceDataBatch::new()],
+    };
+    batches.into_iter().map(|batch| batch.with_max_rows(max_rows)).collect()
+}
 
-        let current_chrom_arc: Arc<Vec<u8>> = Arc::new(chrom_sequence_data);
-        let chrom_len = current_chrom_arc.len();
+/// Prepares the jobs of every chromosome of a wave, then spawns their tasks on
+/// `scope`, which compute and send the pairs, and returns without waiting for
+/// them: the next wave is prepared and its tasks queued while this wave's last
+/// tasks still run, so the pool does not drain between waves. With
+/// `compressor`, the workers encode and compress their batches before sending
+/// them. The wave's sequence and `reservation` are released once its tasks are
+/// done, and the first error sets `failed`.
+fn run_wave<'scope>(scope: &rayon::Scope<'scope>, wave: fasta_index::Wave, reservation: prefetch::Reservation,
+                    tier_prefix_lens: Option<&'scope [usize]>, max_distance: Option<u16>, compact: bool, batch_rows: usize,
+                    matrix: Option<&'scope matrix::MatrixFile>, compressor: Option<&'scope output::BatchEncoder>,
+                    tx: &'scope Sender<output::WriterMessage>, failed: &'scope AtomicBool) {
+    // Every chromosome of the wave becomes a job up front, so that one schedule covers the whole wave.
+    let total_grid_points: usize = wave.contigs.iter().map(|contig| contig.range.len() / GRID_SPACING).sum();
+    let mut jobs: Vec<ChromosomeJob> = Vec::with_capacity(wave.contigs.len());
+    // Position of each job's chromosome in the input, which is its section of the matrix output.
+    let mut job_inputs: Vec<usize> = Vec::with_capacity(wave.contigs.len());
+    for (&input_index, genome::Contig { name: chrom_name, range }) in wave.inputs.iter().zip(wave.contigs) {
+        let chrom_len = range.len();
+        println!("Processing chromosome: {} (length: {} bp)", chrom_name, chrom_len);
+        if let Some(matrix) = matrix {
+            matrix.set_grid_points(input_index, chrom_len / GRID_SPACING);
+        }
 
         if chrom_len == 0 {
             eprintln!("Chromosome {} is empty. Skipping.", chrom_name);
@@ -163,85 +511,381 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
         let total_pairs_for_chrom = if num_grid_points > 1 { num_grid_points * (num_grid_points - 1) / 2 } else {0};
         println!("  {} grid points for chromosome {}, {} pairwise comparisons.", num_grid_points, chrom_name, total_pairs_for_chrom);
 
+        // The far-tier pair cache budget is shared out by chromosome size.
+        let far_pair_cache_capacity = (FAR_PAIR_CACHE_CAPACITY as u128 * num_grid_points as u128 / total_grid_points as u128) as usize;
+        jobs.push(ChromosomeJob::new(chrom_name, wave.sequence.clone(), range.start, num_grid_points, tier_prefix_lens.is_some(), far_pair_cache_capacity));
+        job_inputs.push(input_index);
+    }
 
-        let name_for_tasks = chrom_name.clone();
-        let tx_clone_for_chrom = tx.clone();
-
-        let computation_result_for_chrom = (0..num_grid_points.saturating_sub(1))
-            .into_par_iter()
-            .try_for_each(|idx1| -> Result<(), ChannelSendError> {
-                let mut current_batch_data = DistanceDataBatch::new();
-                // --- THIS IS THE CORRECTED LINE ---
-                let local_chrom_arc_clone = Arc::clone(&current_chrom_arc);
-
-                // --- END CORRECTION ---
-
-                let pos1 = idx1 * GRID_SPACING;
-
-                for idx2 in (idx1 + 1)..num_grid_points {
-                    let pos2 = idx2 * GRID_SPACING;
-                    let genome_dist = pos2 - pos1;
+    // Tasks of all chromosomes, most expensive first; each one is a separate stealable unit of work.
+    let job_grid_points: Vec<usize> = jobs.iter().map(|job| job.num_grid_points).collect();
+    let tasks = match tier_prefix_lens {
+        Some(_) => schedule::plan_tasks(&job_grid_points, &[], &[TIER_PAIR_COSTS[cli::NUM_TIERS - 1]]),
+        None => schedule::plan_tasks(&job_grid_points, &TIER_MAX_GRID_OFFSETS, &TIER_PAIR_COSTS),
+    };
+    for task in &tasks {
+        for job in task.jobs() {
+            jobs[job].remaining_tasks.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+    println!("Scheduled {} task(s) over {} chromosome(s).", tasks.len(), jobs.len());
+
+    scope.spawn(move |_| {
+        let values_per_pair = tier_prefix_lens.map_or(1, |prefix_lens| prefix_lens.len());
+        // Compact mode keeps one batch per tier, since each tier goes to its own file.
+        let new_batches = || new_batches(tier_prefix_lens, compact, batch_rows);
+        let send_batch = |compressor: &mut Option<output::BatchCompressor>, chrom_name: &str, batch: DistanceDataBatch|
+                          -> Result<(), Box<dyn std::error::Error + Send + Sync>> {
+            if batch.is_empty() {
+                return Ok(());
+            }
+            let message = match compressor {
+                Some(compressor) => compressor.encode(chrom_name, batch)?,
+                None => output::WriterMessage::Batch(chrom_name.to_string(), batch),
+            };
+            tx.send(message).map_err(|_| {
+                eprintln!("Error: Worker (chrom {}) failed to send batch. Writer thread might be down.", chrom_name);
+                ChannelSendError.into()
+            })
+        };
+        let result = tasks
+            .par_iter()
+            .with_max_len(1)
+            .try_for_each_init(|| (dedup::RowPlanner::default(), compressor.map(output::BatchCompressor::new)),
+                               |(planner, compressor), task| -> Result<(), Box<dyn std::error::Error + Send + Sync>> {
+                // Batches hold a single chromosome, so they are flushed whenever the task moves to the next job.
+                let mut current_job: Option<usize> = None;
+                let mut current_batches = new_batches();
+                for (job_index, tile) in task.tiles() {
+                    let job = &jobs[job_index];
+                    if current_job != Some(job_index) {
+                        if let Some(previous) = current_job {
+                            for batch in std::mem::replace(&mut current_batches, new_batches()) {
+                                send_batch(compressor, &jobs[previous].name, batch)?;
+                            }
+                        }
+                        current_job = Some(job_index);
+                    }
 
-                    let (len_to_compare, dist_type_val) = if genome_dist <= DIST_THRESHOLD_1 {
-                        (CHUNK_SIZE_1, 0u8)
-                    } else if genome_dist <= DIST_THRESHOLD_2 {
-                        (CHUNK_SIZE_2, 1u8)
-                    } else {
-                        (GRID_SPACING, 2u8)
-                    };
-                    
-                    let seq1 = &local_chrom_arc_clone[pos1 .. pos1 + len_to_compare];
-                    let seq2 = &local_chrom_arc_clone[pos2 .. pos2 + len_to_compare];
+                    for idx1 in tile.idx1_range(job.num_grid_points) {
+                        let idx2_range = tile.idx2_range_for_row(idx1, job.num_grid_points);
+                        if idx2_range.is_empty() {
+                            continue;
+                        }
+                        let row_distances = job.compute_row_segment(planner, idx1, idx2_range.clone(), tier_prefix_lens, max_distance);
 
-                    let dist = levenshtein::levenshtein_distance(seq1, seq2);
-                    current_batch_data.add(idx1 as u32, idx2 as u32, dist, dist_type_val);
+                        if let Some(matrix) = matrix {
+                            matrix.write_row(job_inputs[job_index], idx1, idx2_range.start, &row_distances);
+                            continue;
+                        }
+                        if compact {
+                            for (tier, run) in tier_runs(idx1, idx2_range.clone()) {
+                                let batch = &mut current_batches[tier as usize];
+                                batch.add_run(idx1 as u32, run.start as u32, &row_distances[run.start - idx2_range.start..run.end - idx2_range.start]);
+                                if batch.is_full() {
+                                    send_batch(compressor, &job.name, std::mem::replace(batch, DistanceDataBatch::for_tier_runs(tier).with_max_rows(batch_rows)))?;
+                                }
+                            }
+                            continue;
+                        }
 
-                    if current_batch_data.is_full() {
-                        if tx_clone_for_chrom.send((name_for_tasks.clone(), current_batch_data)).is_err() {
-                            eprintln!("Error: Worker (chrom {}, idx1={}) failed to send batch. Writer thread might be down.", name_for_tasks, idx1);
-                            return Err(ChannelSendError);
+                        let batch = &mut current_batches[0];
+                        for (idx2, pair_distances) in idx2_range.zip(row_distances.chunks_exact(values_per_pair)) {
+                            if tier_prefix_lens.is_some() {
+                                batch.add_tiers(idx1 as u32, idx2 as u32, pair_distances);
+                            } else {
+                                let (_, dist_type_val) = tier_for_grid_offset(idx2 - idx1);
+                                batch.add(idx1 as u32, idx2 as u32, pair_distances[0], dist_type_val);
+                            }
+
+                            if batch.is_full() {
+                                send_batch(compressor, &job.name, std::mem::replace(batch, new_batches().swap_remove(0)))?;
+                            }
                         }
-                        current_batch_data = DistanceDataBatch::new();
                     }
                 }
 
-                if !current_batch_data.is_empty() {
-                    if tx_clone_for_chrom.send((name_for_tasks.clone(), current_batch_data)).is_err() {
-                         eprintln!("Error: Worker (chrom {}, idx1={}) failed to send final batch. Writer thread might be down.", name_for_tasks, idx1);
-                        return Err(ChannelSendError);
+                if let Some(job_index) = current_job {
+                    for batch in current_batches {
+                        send_batch(compressor, &jobs[job_index].name, batch)?;
+                    }
+                }
+                for job_index in task.jobs() {
+                    if jobs[job_index].remaining_tasks.fetch_sub(1, Ordering::AcqRel) == 1 {
+                        jobs[job_index].report_finished();
                     }
                 }
                 Ok(())
             });
+        // The wave's sequence goes back to the prefetch budget once its last task is done.
+        drop(jobs);
+        drop(reservation);
+        if let Err(e) = result {
+            if !failed.swap(true, Ordering::Relaxed) {
+                eprintln!("An error occurred while computing distances: {}. Output is incomplete.", e);
+            }
+        }
+    });
+}
 
-        if let Err(e) = computation_result_for_chrom {
-            eprintln!("An error occurred processing chromosome {}: {}. Proceeding to next chromosome if any.", chrom_name, e);
-        } else {
-            println!("Successfully finished processing chromosome: {}", chrom_name);
+fn main() -> Result<(), Box<dyn std::error::Error>> {
+    let options = cli::parse_args(std::env::args().skip(1))?;
+    let fasta_path = options.fasta_path;
+    let output_path = options.output_path;
+    let max_distance = options.max_distance;
+    if let Some(k) = max_distance {
+        println!("Threshold mode: distances above {} are reported as {}.", k, k + 1);
+    }
+    // All-tiers mode: window lengths of the reported tiers, all taken from one DP over the largest window.
+    let tier_prefix_lens: Option<Vec<usize>> = options.report_tiers.as_ref()
+        .map(|tiers| tiers.iter().map(|&tier| TIER_WINDOW_LENS[tier]).collect());
+    if let Some(prefix_lens) = &tier_prefix_lens {
+        println!("All-tiers mode: reporting {:?} bp distances for every pair.", prefix_lens);
+    }
+
+    println!("Loading chromosome sequences from: {}", fasta_path);
+    let source = fasta_index::ChromosomeSource::open(&fasta_path)
+        .map_err(|e| format!("Failed to load FASTA file '{}': {}", fasta_path, e))?;
+
+    if source.is_empty() {
+        println!("No chromosome sequences loaded from {}. Exiting.", fasta_path);
+        return Ok(());
+    }
+    match &source {
+        fasta_index::ChromosomeSource::Loaded { .. } => println!("Loaded {} chromosome sequence(s).", source.len()),
+        _ => println!("Indexed {} chromosome sequence(s); each is loaded when computation reaches it.", source.len()),
+    }
+
+    // The chromosome column is dictionary-encoded against every name in the input, so each batch
+    // only stores one key per row, and the file keeps a single dictionary as the IPC format requires.
+    let mut chrom_keys: HashMap<String, i32> = HashMap::new();
+    let mut chrom_names: Vec<&str> = Vec::new();
+    for name in source.names() {
+        if !chrom_keys.contains_key(name) {
+            chrom_keys.insert(name.to_string(), chrom_names.len() as i32);
+            chrom_names.push(name);
+        }
+    }
+    let chrom_dictionary: ArrayRef = Arc::new(StringArray::from(chrom_names));
+
+    let chromosome_field = Field::new("chromosome", DataType::Dictionary(Box::new(DataType::Int32), Box::new(DataType::Utf8)), false);
+    let mut fields = vec![
+        chromosome_field.clone(),
+        Field::new("idx1", DataType::UInt32, false),
+        Field::new("idx2", DataType::UInt32, false),
+    ];
+    match &tier_prefix_lens {
+        Some(prefix_lens) => {
+            for len in prefix_lens {
+                fields.push(Field::new(&format!("distance_{}bp", len), DataType::UInt16, false));
+            }
+        }
+        None => {
+            fields.push(Field::new("distance", DataType::UInt16, false));
+            fields.push(Field::new("type", DataType::UInt8, false));
+        }
+    }
+
+    // Compact mode writes one file per tier, whose rows are runs of one row's pairs: idx1, the offset
+    // of the first idx2 from it, and the list of distances; the tier is in the schema metadata.
+    let outputs: Vec<(String, SchemaRef)> = if options.matrix {
+        Vec::new()
+    } else if options.compact {
+        (0..cli::NUM_TIERS)
+            .map(|tier| {
+                let item = Field::new("item", compact_distance_type(tier, max_distance), false);
+                let fields = vec![
+                    chromosome_field.clone(),
+                    Field::new("idx1", DataType::UInt32, false),
+                    Field::new("idx2_offset", DataType::UInt32, false),
+                    Field::new("distances", DataType::List(Arc::new(item)), false),
+                ];
+                let metadata = HashMap::from([
+                    ("tier".to_string(), tier.to_string()),
+                    ("window_len".to_string(), TIER_WINDOW_LENS[tier].to_string()),
+                ]);
+                (compact_tier_path(&output_path, tier), Arc::new(Schema::new(fields).with_metadata(metadata)))
+            })
+            .collect()
+    } else {
+        vec![(output_path.clone(), Arc::new(Schema::new(fields)))]
+    };
+    let schemas = outputs.iter().map(|(_, schema)| schema.clone()).collect();
+    let format = if options.parquet {
+        println!("Parquet mode: each batch of up to {} rows is written as one row group.", PARQUET_ROW_GROUP_ROWS);
+        output::OutputFormat::Parquet(options.compression)
+    } else {
+        if let Some(codec) = options.compression {
+            println!("Compressing IPC output with {:?} in the worker threads; output is in the IPC stream format.", codec);
+        }
+        output::OutputFormat::Ipc(options.compression)
+    };
+    let batch_rows = if options.parquet { PARQUET_ROW_GROUP_ROWS } else { ARROW_BATCH_SIZE };
+    let encoder = Arc::new(output::BatchEncoder::new(chrom_keys, chrom_dictionary, schemas, max_distance, format)?);
+    let mut arrow_writers = Vec::with_capacity(outputs.len());
+    for (tier, ((path, _), empty)) in outputs.iter().zip(new_batches(tier_prefix_lens.as_deref(), options.compact, batch_rows)).enumerate() {
+        if options.compact {
+            println!("Compact mode: writing {} bp tier runs to '{}'.", TIER_WINDOW_LENS[tier], path);
         }
+        let file = File::create(path)
+            .map_err(|e| format!("Failed to create output file '{}': {}", path, e))?;
+        let buf_writer = BufWriter::with_capacity(128 * 1024, file);
+        arrow_writers.push(encoder.create_output(buf_writer, tier, empty)?);
     }
 
+    let num_threads_for_pool = num_cpus::get();
+    println!("Using Rayon thread pool with up to {} threads for computation.", num_threads_for_pool);
+    println!("Near-tier batch kernel instruction set: {}", levenshtein::simd_level().name());
+
+    let (tx, rx) = bounded::<output::WriterMessage>(num_threads_for_pool.max(1) * 2);
+
+    // Matrix mode has workers write in place, and no writer thread.
+    let matrix_file = if options.matrix {
+        // Sections are sized from the index lengths, which bound the lengths loaded.
+        let chromosomes: Vec<(&str, usize)> = source.names().into_iter().zip(source.lens()).map(|(name, len)| (name, len / GRID_SPACING)).collect();
+        let matrix_file = matrix::MatrixFile::create(&output_path, GRID_SPACING, &TIER_MAX_GRID_OFFSETS, &chromosomes)
+            .map_err(|e| format!("Failed to create output file '{}': {}", output_path, e))?;
+        println!("Matrix mode: writing distances in place to '{}'.", output_path);
+        Some(matrix_file)
+    } else {
+        None
+    };
+    let writer_encoder = encoder.clone();
+    let output_kind = match outputs.len() {
+        0 => "distance matrix".to_string(),
+        1 => encoder.output_kind().to_string(),
+        _ => format!("{}s", encoder.output_kind()),
+    };
+    let writer_output_kind = output_kind.clone();
+    let writer_thread = (!arrow_writers.is_empty()).then(|| thread::spawn(move || -> ArrowResult<()> {
+        let mut batches_written = 0;
+        let mut total_rows_written = 0;
+        loop {
+            match rx.recv() {
+                Ok(message) => {
+                    let num_rows = match message {
+                        output::WriterMessage::Batch(chrom_name_for_batch, batch_data) => {
+                            let num_rows = batch_data.idx1.len();
+                            if num_rows == 0 { continue; }
+                            let arrow_writer = &mut arrow_writers[output::output_of(&batch_data)];
+                            arrow_writer.write(&writer_encoder.record_batch(&chrom_name_for_batch, batch_data)?)?;
+                            num_rows
+                        }
+                        output::WriterMessage::Encoded { output, rows, message } => {
+                            arrow_writers[output].append_encoded(&message)?;
+                            rows
+                        }
+                    };
+                    batches_written += 1;
+                    total_rows_written += num_rows;
+                    if batches_written % 100 == 0 {
+                        println!("Writer thread: Written {} batches ({} rows total) to {}.", batches_written, total_rows_written, writer_output_kind);
+                    }
+                }
+                Err(_) => {
+                    println!("Writer thread: All data received. Finalizing {}.", writer_output_kind);
+                    for arrow_writer in arrow_writers.iter_mut() {
+                        arrow_writer.finish()?;
+                    }
+                    println!("Writer thread: {} finished. Total batches written: {}, total rows: {}.", writer_output_kind, batches_written, total_rows_written);
+                    break Ok(());
+                }
+            }
+        }
+    }));
+
+    // Chromosomes are loaded a wave at a time, the next ones while the current one is computed,
+    // and each wave is freed once its pairs are sent to the writer.
+    let mut load_error = None;
+    let failed = AtomicBool::new(false);
+    let (tier_prefix_lens, matrix) = (tier_prefix_lens.as_deref(), matrix_file.as_ref());
+    let compressor = encoder.is_compressed().then_some(&*encoder);
+    thread::scope(|scope| {
+        let waves = prefetch::prefetch_waves(scope, &source, WAVE_BASES, options.prefetch_waves, options.prefetch_memory);
+        // Every wave's tasks run in one scope, so a wave's tail overlaps the start of the next one.
+        rayon::in_place_scope(|wave_scope| {
+            for wave in waves {
+                let (wave, reservation) = match wave {
+                    Ok(loaded) => loaded,
+                    Err(e) => {
+                        load_error = Some(e);
+                        break;
+                    }
+                };
+                if failed.load(Ordering::Relaxed) {
+                    break;
+                }
+                run_wave(wave_scope, wave, reservation, tier_prefix_lens, max_distance, options.compact, batch_rows,
+                         matrix, compressor, &tx, &failed);
+            }
+        });
+    });
+
     drop(tx);
 
-    match writer_thread.join() {
-        Ok(Ok(_)) => println!("Writer thread finished successfully and Arrow IPC file finalized."),
-        Ok(Err(arrow_err)) => {
-            eprintln!("Writer thread failed with Arrow error: {:?}", arrow_err);
-            return Err(Box::new(arrow_err));
-        }
-        Err(panic_payload) => {
-            eprintln!("Writer thread panicked: {:?}", panic_payload);
-            let panic_msg = if let Some(s) = panic_payload.downcast_ref::<String>() {
-                s.clone()
-            } else if let Some(s) = panic_payload.downcast_ref::<&str>() {
-                s.to_string()
-            } else {
-                "Writer thread panicked with an unknown type".to_string()
-            };
-            return Err(Box::new(std::io::Error::new(std::io::ErrorKind::Other, panic_msg)));
+    if let Some(writer_thread) = writer_thread {
+        match writer_thread.join() {
+            Ok(Ok(_)) => println!("Writer thread finished successfully and {} finalized.", output_kind),
+            Ok(Err(arrow_err)) => {
+                eprintln!("Writer thread failed with Arrow error: {:?}", arrow_err);
+                return Err(Box::new(arrow_err));
+            }
+            Err(panic_payload) => {
+                eprintln!("Writer thread panicked: {:?}", panic_payload);
+                let panic_msg = if let Some(s) = panic_payload.downcast_ref::<String>() {
+                    s.clone()
+                } else if let Some(s) = panic_payload.downcast_ref::<&str>() {
+                    s.to_string()
+                } else {
+                    "Writer thread panicked with an unknown type".to_string()
+                };
+                return Err(Box::new(std::io::Error::new(std::io::ErrorKind::Other, panic_msg)));
+            }
         }
     }
 
-    println!("Program finished. Output written to specified IPC file.");
+    if let Some(matrix_file) = matrix_file {
+        matrix_file.finish()?;
+        println!("Distance matrix written to '{}'.", output_path);
+    }
+
+    if let Some(e) = load_error {
+        return Err(format!("Failed to load FASTA file '{}': {}. Output is incomplete.", fasta_path, e).into());
+    }
+    let output_paths: Vec<&str> = match outputs.is_empty() {
+        true => vec![&output_path],
+        false => outputs.iter().map(|(path, _)| path.as_str()).collect(),
+    };
+    println!("Program finished. Output written as {} to '{}'.", output_kind, output_paths.join("', '"));
     Ok(())
-}
\ No newline at end of file
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_tier_runs_split_at_tier_boundaries() {
+        assert_eq!(TIER_MAX_GRID_OFFSETS, [100, 1000]);
+        let runs = |idx1: usize, idx2_range: Range<usize>| tier_runs(idx1, idx2_range).collect::<Vec<_>>();
+        // Offsets 1 to 100 are tier 0, 101 to 1000 tier 1, and the rest tier 2.
+        assert_eq!(runs(5, 6..2000), vec![(0, 6..106), (1, 106..1006), (2, 1006..2000)]);
+        assert_eq!(runs(5, 105..1007), vec![(0, 105..106), (1, 106..1006), (2, 1006..1007)]);
+        assert_eq!(runs(0, 101..1001), vec![(1, 101..1001)]);
+        assert_eq!(runs(0, 1001..1002), vec![(2, 1001..1002)]);
+        assert!(runs(3, 9..9).is_empty());
+    }
+
+    #[test]
+    fn test_compact_distance_type() {
+        for k in [None, Some(0), Some(254), Some(255), Some(u16::MAX - 1)] {
+            assert_eq!(compact_distance_type(0, k), DataType::UInt8);
+            assert_eq!(compact_distance_type(1, k), DataType::UInt8);
+        }
+        // Tier 2 distances reach K + 1 under a threshold, and the 1 kb window otherwise.
+        assert_eq!(compact_distance_type(2, Some(0)), DataType::UInt8);
+        assert_eq!(compact_distance_type(2, Some(254)), DataType::UInt8);
+        assert_eq!(compact_distance_type(2, Some(255)), DataType::UInt16);
+        assert_eq!(compact_distance_type(2, None), DataType::UInt16);
+    }
+}
@@ -0,0 +1,227 @@
+//! Dense distance matrix output.
+//!
+//! Every chromosome's pairs form a complete upper triangle, so the matrix file
+//! stores the distances alone, at positions computed from (idx1, idx2). Each
+//! near tier is a band of u8 distances, one fixed-width row per grid point, and
+//! the far tier is the packed remainder of the triangle in u16. Workers write
+//! their rows straight into the memory-mapped file, and a reader maps it and
+//! finds d(i, j) in O(1).
+//!
+//! Layout, all integers little-endian:
+//!
+//! ```text
+//! header      magic "LEVXMAT1", then u64 grid spacing, band count B, chromosome count C
+//! bands       B x u64: largest idx2 - idx1 of each band, ascending
+//! chromosomes C x 5 u64: grid points n, offset of the bands, offset of the far
+//!             triangle, name offset, name length
+//! names       UTF-8, back to back
+//! data        per chromosome, 64-byte aligned, sized for the grid points of
+//!             its length in the input's index, of which n may be fewer
+//!             (n is 0 for a chromosome that was not loaded):
+//!             band b: n rows of (max_b - max_{b-1}) u8, row i holding
+//!                     j = i + max_{b-1} + 1 onward (cells past n - 1 are 0)
+//!             far:    rows i = 0..m of m - i u16, row i holding j = i + max_{B-1} + 1
+//!                     onward, where m = n - max_{B-1} - 1; row i starts at entry
+//!                     i * m - i * (i - 1) / 2
+//! ```
+
+use memmap2::MmapMut;
+use std::fs::OpenOptions;
+use std::io::{Error, ErrorKind};
+use std::sync::atomic::{AtomicUsize, Ordering};
+
+const MAGIC: &[u8; 8] = b"LEVXMAT1";
+
+/// Data sections start on a cache line.
+const SECTION_ALIGN: usize = 64;
+
+/// Where one chromosome's distances are in the file.
+struct Section {
+    /// Most grid points the section has room for.
+    capacity: usize,
+    /// Grid points of the chromosome as loaded, 0 until then.
+    num_grid_points: AtomicUsize,
+    bands_offset: usize,
+    far_offset: usize,
+    /// Position of the chromosome's header entry.
+    entry_offset: usize,
+}
+
+/// Entries before row `row` of a packed triangle whose first row has `rows` entries.
+fn triangle_row_start(rows: usize, row: usize) -> usize {
+    row * rows - row * row.saturating_sub(1) / 2
+}
+
+/// A matrix file being written, shared by all workers.
+pub struct MatrixFile {
+    map: MmapMut,
+    /// Base of `map`, which writers fill through shared references.
+    base: *mut u8,
+    /// Largest grid offset of each band.
+    band_max_offsets: Vec<usize>,
+    sections: Vec<Section>,
+}
+
+// SAFETY: the map is only written through `write_row`, at the cells of one
+// pair each, and every pair is computed by exactly one task, and through
+// `set_grid_points`, at the header entry of a chromosome none of whose pairs
+// is being computed yet.
+unsafe impl Send for MatrixFile {}
+unsafe impl Sync for MatrixFile {}
+
+impl MatrixFile {
+    /// Creates the file at `path` for chromosomes of the given names and most
+    /// grid points, with u8 bands up to each of `band_max_offsets`. Each
+    /// chromosome's actual grid points are set once it is loaded.
+    pub fn create(path: &str, grid_spacing: usize, band_max_offsets: &[usize], chromosomes: &[(&str, usize)]) -> Result<Self, Error> {
+        let mut header = MAGIC.to_vec();
+        for value in [grid_spacing, band_max_offsets.len(), chromosomes.len()].iter().chain(band_max_offsets) {
+            header.extend_from_slice(&(*value as u64).to_le_bytes());
+        }
+        let entries_start = header.len();
+        let names_start = entries_start + chromosomes.len() * 5 * 8;
+        let names_len: usize = chromosomes.iter().map(|(name, _)| name.len()).sum();
+        let band_width: usize = band_max_offsets.last().copied().unwrap_or(0);
+
+        let mut sections = Vec::with_capacity(chromosomes.len());
+        let mut end = names_start + names_len;
+        let mut name_offset = names_start;
+        for &(name, capacity) in chromosomes {
+            let bands_offset = end.next_multiple_of(SECTION_ALIGN);
+            let far_offset = (bands_offset + capacity * band_width).next_multiple_of(SECTION_ALIGN);
+            let far_rows = capacity.saturating_sub(band_width + 1);
+            end = far_offset + 2 * triangle_row_start(far_rows, far_rows);
+            let entry_offset = header.len();
+            for value in [0, bands_offset, far_offset, name_offset, name.len()] {
+                header.extend_from_slice(&(value as u64).to_le_bytes());
+            }
+            name_offset += name.len();
+            sections.push(Section { capacity, num_grid_points: AtomicUsize::new(0), bands_offset, far_offset, entry_offset });
+        }
+        for (name, _) in chromosomes {
+            header.extend_from_slice(name.as_bytes());
+        }
+
+        let file = OpenOptions::new().read(true).write(true).create(true).truncate(true).open(path)?;
+        // The file is sparse until written; cells no task covers stay 0.
+        file.set_len(end.max(header.len()) as u64)?;
+        // SAFETY: the file was just created for this run and nothing else maps or resizes it.
+        let mut map = unsafe { MmapMut::map_mut(&file)? };
+        map[..header.len()].copy_from_slice(&header);
+        let base = map.as_mut_ptr();
+        Ok(MatrixFile { map, base, band_max_offsets: band_max_offsets.to_vec(), sections })
+    }
+
+    /// Sets the grid points of chromosome `chromosome` as loaded, before any of
+    /// its rows are written.
+    pub fn set_grid_points(&self, chromosome: usize, num_grid_points: usize) {
+        let section = &self.sections[chromosome];
+        assert!(num_grid_points <= section.capacity, "more grid points than the index gave room for");
+        section.num_grid_points.store(num_grid_points, Ordering::Relaxed);
+        // SAFETY: the entry is inside the header, which workers do not write.
+        unsafe { std::ptr::copy_nonoverlapping((num_grid_points as u64).to_le_bytes().as_ptr(), self.base.add(section.entry_offset), 8) };
+    }
+
+    /// Writes the distances from grid point `idx1` to `idx2_start` onward of
+    /// chromosome `chromosome`, as a worker computed them for one row segment.
+    pub fn write_row(&self, chromosome: usize, idx1: usize, idx2_start: usize, distances: &[u16]) {
+        let section = &self.sections[chromosome];
+        let num_grid_points = section.num_grid_points.load(Ordering::Relaxed);
+        assert!(idx1 < idx2_start && idx2_start + distances.len() <= num_grid_points, "pairs outside the chromosome's triangle");
+        let band_width = self.band_max_offsets.last().copied().unwrap_or(0);
+        let far_rows = num_grid_points.saturating_sub(band_width + 1);
+        for (offset, &distance) in (idx2_start - idx1..).zip(distances) {
+            if offset <= band_width {
+                let band = self.band_max_offsets.partition_point(|&max_offset| max_offset < offset);
+                let band_start = if band == 0 { 0 } else { self.band_max_offsets[band - 1] };
+                let band_len = self.band_max_offsets[band] - band_start;
+                // Band `band` follows the earlier ones, whose widths add up to `band_start`.
+                let pos = section.bands_offset + band_start * num_grid_points + idx1 * band_len + (offset - band_start - 1);
+                debug_assert!(pos < section.far_offset);
+                // SAFETY: the assertions above keep `pos` in this chromosome's bands, and
+                // no other task writes this pair.
+                unsafe { *self.base.add(pos) = distance.min(u8::MAX as u16) as u8 };
+            } else {
+                let pos = section.far_offset + 2 * (triangle_row_start(far_rows, idx1) + (offset - band_width - 1));
+                debug_assert!(pos + 2 <= self.map.len());
+                // SAFETY: as above, in this chromosome's far triangle.
+                unsafe { std::ptr::copy_nonoverlapping(distance.to_le_bytes().as_ptr(), self.base.add(pos), 2) };
+            }
+        }
+    }
+
+    /// Flushes the distances to disk.
+    pub fn finish(self) -> Result<(), Error> {
+        self.map.flush().map_err(|e| Error::new(ErrorKind::Other, format!("Failed to flush distance matrix: {}", e)))
+    }
+}
+
+/// Reads d(idx1, idx2) of chromosome `chromosome` from a matrix file, as a
+/// reader would.
+#[cfg(test)]
+fn read_distance(data: &[u8], chromosome: usize, idx1: usize, idx2: usize) -> u16 {
+    let u64_at = |pos: usize| u64::from_le_bytes(data[pos..pos + 8].try_into().unwrap()) as usize;
+    assert_eq!(&data[..8], MAGIC);
+    let num_bands = u64_at(16);
+    let band_max_offsets: Vec<usize> = (0..num_bands).map(|band| u64_at(32 + 8 * band)).collect();
+    let entry = 32 + 8 * num_bands + 40 * chromosome;
+    let (n, bands_offset, far_offset) = (u64_at(entry), u64_at(entry + 8), u64_at(entry + 16));
+    let offset = idx2 - idx1;
+    let mut band_start = 0;
+    for &max_offset in &band_max_offsets {
+        if offset <= max_offset {
+            return data[bands_offset + band_start * n + idx1 * (max_offset - band_start) + offset - band_start - 1] as u16;
+        }
+        band_start = max_offset;
+    }
+    let rows = n - band_start - 1;
+    let pos = far_offset + 2 * (triangle_row_start(rows, idx1) + offset - band_start - 1);
+    u16::from_le_bytes([data[pos], data[pos + 1]])
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_matrix_round_trip() {
+        let path = std::env::temp_dir().join(format!("levx-matrix-test-{}.bin", std::process::id()));
+        let path = path.to_str().unwrap();
+        let chromosomes = [("chr1", 20), ("chrTiny", 2), ("chr2", 9), ("chrUnloaded", 4)];
+        let distance = |chromosome: usize, i: usize, j: usize| ((chromosome * 1000 + i * 31 + j * 7) % 300) as u16;
+        // chr2 loads shorter than its index entry, and chrUnloaded never loads.
+        let mut capacities: Vec<(&str, usize)> = chromosomes.to_vec();
+        capacities[2].1 = 12;
+        let matrix = MatrixFile::create(path, 1000, &[2, 5], &capacities).unwrap();
+        for (chromosome, &(_, n)) in chromosomes.iter().enumerate().take(3) {
+            matrix.set_grid_points(chromosome, n);
+        }
+        // Rows written in segments, out of order.
+        for (chromosome, &(_, n)) in chromosomes.iter().enumerate().take(3).rev() {
+            for i in (0..n).rev() {
+                let mut start = i + 1;
+                while start < n {
+                    let end = (start + 4).min(n);
+                    let row: Vec<u16> = (start..end).map(|j| distance(chromosome, i, j)).collect();
+                    matrix.write_row(chromosome, i, start, &row);
+                    start = end;
+                }
+            }
+        }
+        matrix.finish().unwrap();
+        let data = std::fs::read(path).unwrap();
+        std::fs::remove_file(path).unwrap();
+        let u64_at = |pos: usize| u64::from_le_bytes(data[pos..pos + 8].try_into().unwrap()) as usize;
+        let grid_points: Vec<usize> = (0..chromosomes.len()).map(|chromosome| u64_at(48 + 40 * chromosome)).collect();
+        assert_eq!(grid_points, [20, 2, 9, 0]);
+        for (chromosome, &(_, n)) in chromosomes.iter().enumerate().take(3) {
+            for i in 0..n {
+                for j in i + 1..n {
+                    // Band distances are u8; these test values only exceed 255 in the far triangle.
+                    let expected = if j - i <= 5 { distance(chromosome, i, j).min(255) } else { distance(chromosome, i, j) };
+                    assert_eq!(read_distance(&data, chromosome, i, j), expected, "chromosome {} ({}, {})", chromosome, i, j);
+                }
+            }
+        }
+    }
+}
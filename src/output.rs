@@ -0,0 +1,430 @@
+//! Arrow IPC and Parquet output of the distance batches.
+//!
+//! By default workers send their batches to the writer thread, which builds the
+//! record batches and writes them. With IPC compression, the workers build and
+//! compress their own batches into finished IPC messages instead, so that the
+//! codec runs on the whole pool, and the writer thread only appends the bytes.
+//! Messages encoded apart can be concatenated in the IPC stream format, which
+//! has no footer indexing them, so compressed output is written as a stream.
+//!
+//! Parquet output writes every batch as its own row group. A worker's batch
+//! holds one chromosome and rows of one idx1 block, so the min/max statistics
+//! of each row group let readers skip whole blocks of the triangle.
+
+use crate::{compact_distance_type, DistanceDataBatch};
+use arrow::array::{ArrayRef, DictionaryArray, ListArray, PrimitiveArray};
+use arrow::buffer::{OffsetBuffer, ScalarBuffer};
+use arrow::datatypes::{DataType, Field, Int32Type, SchemaRef, UInt16Type, UInt32Type, UInt8Type};
+use arrow::error::Result as ArrowResult;
+use arrow::ipc::writer::{FileWriter, IpcWriteOptions, StreamWriter};
+use arrow::ipc::CompressionType;
+use arrow::record_batch::RecordBatch;
+use parquet::arrow::ArrowWriter;
+use parquet::basic::{Compression, Encoding, ZstdLevel};
+use parquet::file::properties::{EnabledStatistics, WriterProperties};
+use parquet::schema::types::ColumnPath;
+use std::collections::HashMap;
+use std::fs::File;
+use std::io::{BufWriter, Write};
+use std::sync::Arc;
+
+/// What workers send to the writer thread.
+pub enum WriterMessage {
+    /// Pairs of the named chromosome, for the writer thread to build and write.
+    Batch(String, DistanceDataBatch),
+    /// A record batch message a worker already encoded for output `output`.
+    Encoded { output: usize, rows: usize, message: Vec<u8> },
+}
+
+/// Format of the output files, with the codec the user asked for.
+pub enum OutputFormat {
+    Ipc(Option<CompressionType>),
+    Parquet(Option<CompressionType>),
+}
+
+/// Output file of a batch: its tier in compact mode, the only one otherwise.
+pub fn output_of(batch: &DistanceDataBatch) -> usize {
+    batch.compact_tier.map_or(0, usize::from)
+}
+
+/// Turns batches into record batches of the output schemas, shared by the
+/// writer thread and, with compression, the workers.
+pub struct BatchEncoder {
+    chrom_keys: HashMap<String, i32>,
+    /// Every chromosome name of the input, the one dictionary of the chromosome column.
+    chrom_dictionary: ArrayRef,
+    schemas: Vec<SchemaRef>,
+    max_distance: Option<u16>,
+    format: OutputFormat,
+    write_options: IpcWriteOptions,
+}
+
+impl BatchEncoder {
+    pub fn new(chrom_keys: HashMap<String, i32>, chrom_dictionary: ArrayRef, schemas: Vec<SchemaRef>,
+               max_distance: Option<u16>, format: OutputFormat) -> ArrowResult<Self> {
+        let ipc_compression = match format {
+            OutputFormat::Ipc(compression) => compression,
+            OutputFormat::Parquet(_) => None,
+        };
+        let write_options = IpcWriteOptions::default().try_with_compression(ipc_compression)?;
+        Ok(BatchEncoder { chrom_keys, chrom_dictionary, schemas, max_distance, format, write_options })
+    }
+
+    /// What the output files are, for progress messages.
+    pub fn output_kind(&self) -> &'static str {
+        match self.format {
+            OutputFormat::Ipc(None) => "Arrow IPC file",
+            OutputFormat::Ipc(Some(_)) => "compressed Arrow IPC stream",
+            OutputFormat::Parquet(_) => "Parquet file",
+        }
+    }
+
+    /// Whether batches go out as compressed IPC messages, which the workers encode.
+    pub fn is_compressed(&self) -> bool {
+        matches!(self.format, OutputFormat::Ipc(Some(_)))
+    }
+
+    /// Builds the record batch of `batch`, whose pairs belong to chromosome `chrom_name`.
+    pub fn record_batch(&self, chrom_name: &str, batch: DistanceDataBatch) -> ArrowResult<RecordBatch> {
+        self.record_batch_for_key(self.chrom_keys[chrom_name], batch)
+    }
+
+    fn record_batch_for_key(&self, chrom_key: i32, mut batch: DistanceDataBatch) -> ArrowResult<RecordBatch> {
+        let num_rows = batch.idx1.len();
+        let col_chrom_name: ArrayRef = Arc::new(DictionaryArray::<Int32Type>::try_new(
+            PrimitiveArray::<Int32Type>::from_value(chrom_key, num_rows),
+            self.chrom_dictionary.clone(),
+        )?);
+
+        let col_idx1: ArrayRef = Arc::new(PrimitiveArray::<UInt32Type>::from(std::mem::take(&mut batch.idx1)));
+        let col_idx2: ArrayRef = Arc::new(PrimitiveArray::<UInt32Type>::from(std::mem::take(&mut batch.idx2)));
+        let mut columns = vec![col_chrom_name, col_idx1, col_idx2];
+        if let Some(tier) = batch.compact_tier {
+            let distance_type = compact_distance_type(tier as usize, self.max_distance);
+            let distances = std::mem::take(&mut batch.dist_val);
+            let values: ArrayRef = if distance_type == DataType::UInt8 {
+                Arc::new(PrimitiveArray::<UInt8Type>::from(distances.iter().map(|&dv| dv as u8).collect::<Vec<u8>>()))
+            } else {
+                Arc::new(PrimitiveArray::<UInt16Type>::from(distances))
+            };
+            let offsets = OffsetBuffer::new(ScalarBuffer::from(std::mem::take(&mut batch.run_ends)));
+            columns.push(Arc::new(ListArray::new(Arc::new(Field::new("item", distance_type, false)), offsets, values, None)));
+        } else if batch.tier_dist_vals.is_empty() {
+            let col_dist_val: ArrayRef = Arc::new(PrimitiveArray::<UInt16Type>::from(std::mem::take(&mut batch.dist_val)));
+            let col_dist_type: ArrayRef = Arc::new(PrimitiveArray::<UInt8Type>::from(std::mem::take(&mut batch.dist_type)));
+            columns.push(col_dist_val);
+            columns.push(col_dist_type);
+        } else {
+            for tier_column in batch.tier_dist_vals.iter_mut() {
+                columns.push(Arc::new(PrimitiveArray::<UInt16Type>::from(std::mem::take(tier_column))) as ArrayRef);
+            }
+        }
+        RecordBatch::try_new(self.schemas[output_of(&batch)].clone(), columns)
+    }
+
+    /// Opens output `output` on `writer`. `empty` is a batch of the output's
+    /// layout; a compressed stream starts with it, which carries the schema and
+    /// the chromosome dictionary that every message from the workers refers to.
+    pub fn create_output(&self, writer: BufWriter<File>, output: usize, empty: DistanceDataBatch) -> ArrowResult<OutputFile> {
+        let schema = &self.schemas[output];
+        match self.format {
+            OutputFormat::Ipc(None) => Ok(OutputFile::Ipc(FileWriter::try_new(writer, schema)?)),
+            OutputFormat::Ipc(Some(_)) => {
+                let mut stream = StreamWriter::try_new_with_options(writer, schema, self.write_options.clone())?;
+                stream.write(&self.record_batch_for_key(0, empty)?)?;
+                Ok(OutputFile::IpcStream(stream))
+            }
+            OutputFormat::Parquet(compression) => {
+                Ok(OutputFile::Parquet(ArrowWriter::try_new(writer, schema.clone(), Some(parquet_properties(compression)))?))
+            }
+        }
+    }
+}
+
+/// A worker's encoders, one IPC stream per output kept in memory, so the
+/// dictionary is only encoded once per output.
+pub struct BatchCompressor<'a> {
+    encoder: &'a BatchEncoder,
+    streams: Vec<Option<StreamWriter<Vec<u8>>>>,
+}
+
+impl<'a> BatchCompressor<'a> {
+    pub fn new(encoder: &'a BatchEncoder) -> Self {
+        BatchCompressor { encoder, streams: (0..encoder.schemas.len()).map(|_| None).collect() }
+    }
+
+    /// Builds and compresses `batch` into a single record batch message.
+    pub fn encode(&mut self, chrom_name: &str, batch: DistanceDataBatch) -> ArrowResult<WriterMessage> {
+        let output = output_of(&batch);
+        let record_batch = self.encoder.record_batch(chrom_name, batch)?;
+        let stream = match &mut self.streams[output] {
+            Some(stream) => stream,
+            slot => {
+                let mut stream = StreamWriter::try_new_with_options(Vec::new(), &self.encoder.schemas[output], self.encoder.write_options.clone())?;
+                // An empty slice sends the schema and the dictionary, which the output already has.
+                stream.write(&record_batch.slice(0, 0))?;
+                slot.insert(stream)
+            }
+        };
+        stream.get_mut().clear();
+        stream.write(&record_batch)?;
+        Ok(WriterMessage::Encoded { output, rows: record_batch.num_rows(), message: std::mem::take(stream.get_mut()) })
+    }
+}
+
+/// Parquet settings: the chromosome and the small distance and type columns
+/// are dictionary-encoded and bit-packed, idx2 (ascending along each row) is
+/// delta-encoded, and every page and row group gets min/max statistics.
+fn parquet_properties(compression: Option<CompressionType>) -> WriterProperties {
+    let codec = match compression {
+        None => Compression::UNCOMPRESSED,
+        Some(CompressionType::LZ4_FRAME) => Compression::LZ4_RAW,
+        Some(_) => Compression::ZSTD(ZstdLevel::default()),
+    };
+    let mut builder = WriterProperties::builder()
+        .set_compression(codec)
+        .set_statistics_enabled(EnabledStatistics::Page)
+        .set_max_row_group_size(crate::PARQUET_ROW_GROUP_ROWS)
+        .set_column_dictionary_enabled(ColumnPath::from("chromosome"), true);
+    // Compact mode stores the offset of a run's first idx2 in place of idx2.
+    for column in ["idx2", "idx2_offset"] {
+        builder = builder
+            .set_column_dictionary_enabled(ColumnPath::from(column), false)
+            .set_column_encoding(ColumnPath::from(column), Encoding::DELTA_BINARY_PACKED);
+    }
+    builder.build()
+}
+
+/// One output file: an IPC file, an IPC stream when compressed, or Parquet.
+pub enum OutputFile {
+    Ipc(FileWriter<BufWriter<File>>),
+    IpcStream(StreamWriter<BufWriter<File>>),
+    Parquet(ArrowWriter<BufWriter<File>>),
+}
+
+impl OutputFile {
+    pub fn write(&mut self, record_batch: &RecordBatch) -> ArrowResult<()> {
+        match self {
+            OutputFile::Ipc(writer) => writer.write(record_batch),
+            OutputFile::IpcStream(writer) => writer.write(record_batch),
+            OutputFile::Parquet(writer) => {
+                writer.write(record_batch)?;
+                // Each batch is its own row group, so its statistics cover a single chromosome and idx1 block.
+                Ok(writer.flush()?)
+            }
+        }
+    }
+
+    /// Appends a message from `BatchCompressor::encode`.
+    pub fn append_encoded(&mut self, message: &[u8]) -> ArrowResult<()> {
+        match self {
+            OutputFile::IpcStream(writer) => Ok(writer.get_mut().write_all(message)?),
+            _ => unreachable!("workers only encode batches for compressed IPC output"),
+        }
+    }
+
+    pub fn finish(&mut self) -> ArrowResult<()> {
+        match self {
+            OutputFile::Ipc(writer) => writer.finish(),
+            OutputFile::IpcStream(writer) => writer.finish(),
+            OutputFile::Parquet(writer) => {
+                writer.finish()?;
+                Ok(())
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use arrow::array::{AsArray, StringArray};
+    use arrow::datatypes::{ArrowPrimitiveType, Schema};
+    use arrow::ipc::reader::StreamReader;
+    use parquet::file::reader::{FileReader, SerializedFileReader};
+    use parquet::file::statistics::Statistics;
+
+    const NAMES: [&str; 3] = ["chr1", "chr2", "chrM"];
+
+    fn test_encoder(outputs: Vec<Vec<Field>>, format: OutputFormat) -> BatchEncoder {
+        let chrom_keys = NAMES.iter().enumerate().map(|(key, name)| (name.to_string(), key as i32)).collect();
+        let chrom_dictionary: ArrayRef = Arc::new(StringArray::from(NAMES.to_vec()));
+        let chromosome = Field::new("chromosome", DataType::Dictionary(Box::new(DataType::Int32), Box::new(DataType::Utf8)), false);
+        let schemas = outputs.into_iter().map(|fields| Arc::new(Schema::new([vec![chromosome.clone()], fields].concat()))).collect();
+        BatchEncoder::new(chrom_keys, chrom_dictionary, schemas, None, format).unwrap()
+    }
+
+    fn pair_fields() -> Vec<Field> {
+        vec![
+            Field::new("idx1", DataType::UInt32, false),
+            Field::new("idx2", DataType::UInt32, false),
+            Field::new("distance", DataType::UInt16, false),
+            Field::new("type", DataType::UInt8, false),
+        ]
+    }
+
+    fn run_fields(tier: usize) -> Vec<Field> {
+        let item = Field::new("item", compact_distance_type(tier, None), false);
+        vec![
+            Field::new("idx1", DataType::UInt32, false),
+            Field::new("idx2_offset", DataType::UInt32, false),
+            Field::new("distances", DataType::List(Arc::new(item)), false),
+        ]
+    }
+
+    /// Writes the batches of each worker through a `BatchCompressor` of its
+    /// own, the workers taking turns, into compressed output `output`, and
+    /// reads the file back.
+    fn write_and_read(encoder: &BatchEncoder, name: &str, output: usize, empty: DistanceDataBatch,
+                      workers: Vec<Vec<(&str, DistanceDataBatch)>>) -> Vec<RecordBatch> {
+        let path = std::env::temp_dir().join(format!("levx-stream-test-{}-{}.arrows", std::process::id(), name));
+        let mut file = encoder.create_output(BufWriter::new(File::create(&path).unwrap()), output, empty).unwrap();
+        let mut compressors: Vec<BatchCompressor> = workers.iter().map(|_| BatchCompressor::new(encoder)).collect();
+        let mut queues: Vec<_> = workers.into_iter().map(Vec::into_iter).collect();
+        let mut written = true;
+        while written {
+            written = false;
+            for (compressor, queue) in compressors.iter_mut().zip(&mut queues) {
+                let Some((chrom_name, batch)) = queue.next() else { continue };
+                let rows = batch.idx1.len();
+                match compressor.encode(chrom_name, batch).unwrap() {
+                    WriterMessage::Encoded { output: encoded_output, rows: encoded_rows, message } => {
+                        assert_eq!((encoded_output, encoded_rows), (output, rows));
+                        file.append_encoded(&message).unwrap();
+                    }
+                    WriterMessage::Batch(..) => panic!("a compressor should only produce encoded messages"),
+                }
+                written = true;
+            }
+        }
+        file.finish().unwrap();
+        drop(file);
+        let batches = StreamReader::try_new(File::open(&path).unwrap(), None).unwrap().collect::<Result<Vec<_>, _>>();
+        std::fs::remove_file(&path).unwrap();
+        batches.unwrap()
+    }
+
+    /// Chromosome names of a batch's rows, looked up in the dictionary.
+    fn chromosomes(batch: &RecordBatch) -> Vec<String> {
+        let column = batch.column(0).as_dictionary::<Int32Type>();
+        let names = column.values().as_string::<i32>();
+        column.keys().values().iter().map(|&key| names.value(key as usize).to_string()).collect()
+    }
+
+    fn values<T: ArrowPrimitiveType>(batch: &RecordBatch, column: usize) -> Vec<T::Native> {
+        batch.column(column).as_primitive::<T>().values().to_vec()
+    }
+
+    /// Rows of compact output batches: chromosome, idx1, idx2 offset and distances.
+    fn runs<T: ArrowPrimitiveType>(batches: &[RecordBatch]) -> Vec<(String, u32, u32, Vec<T::Native>)> {
+        let mut rows = Vec::new();
+        for batch in batches {
+            let (idx1, idx2_offset) = (values::<UInt32Type>(batch, 1), values::<UInt32Type>(batch, 2));
+            let distances = batch.column(3).as_list::<i32>();
+            for (row, name) in chromosomes(batch).into_iter().enumerate() {
+                rows.push((name, idx1[row], idx2_offset[row], distances.value(row).as_primitive::<T>().values().to_vec()));
+            }
+        }
+        rows
+    }
+
+    #[test]
+    fn test_compressed_stream_round_trip() {
+        let pair = |idx1: u32, i: u32| (idx1, idx1 + i + 1, (idx1 * 1000 + i * 37) as u16, (i % 3) as u8);
+        let pairs = |idx1: u32, count: u32| {
+            let mut batch = DistanceDataBatch::new();
+            for i in 0..count {
+                let (idx1, idx2, distance, kind) = pair(idx1, i);
+                batch.add(idx1, idx2, distance, kind);
+            }
+            batch
+        };
+        let encoder = test_encoder(vec![pair_fields()], OutputFormat::Ipc(Some(CompressionType::ZSTD)));
+        let batches = write_and_read(&encoder, "pairs", 0, DistanceDataBatch::new(), vec![
+            vec![("chr1", pairs(0, 5)), ("chrM", pairs(7, 3))],
+            vec![("chr2", pairs(2, 4))],
+            vec![],
+        ]);
+        let mut rows = Vec::new();
+        for batch in &batches {
+            let (idx1, idx2) = (values::<UInt32Type>(batch, 1), values::<UInt32Type>(batch, 2));
+            let (distance, kind) = (values::<UInt16Type>(batch, 3), values::<UInt8Type>(batch, 4));
+            for (row, name) in chromosomes(batch).into_iter().enumerate() {
+                rows.push((name, (idx1[row], idx2[row], distance[row], kind[row])));
+            }
+        }
+        // Workers take turns, so the second batch of the first one comes last.
+        let expected: Vec<_> = [("chr1", 0, 5), ("chr2", 2, 4), ("chrM", 7, 3)].into_iter()
+            .flat_map(|(name, idx1, count)| (0..count).map(move |i| (name.to_string(), pair(idx1, i))))
+            .collect();
+        assert_eq!(rows, expected);
+
+        // Compact output: u8 runs in tier 0, u16 runs in tier 2.
+        let encoder = test_encoder((0..3).map(run_fields).collect(), OutputFormat::Ipc(Some(CompressionType::LZ4_FRAME)));
+        let tier_runs = |tier: u8, runs: &[(u32, u32, &[u16])]| {
+            let mut batch = DistanceDataBatch::for_tier_runs(tier);
+            for &(idx1, first_idx2, distances) in runs {
+                batch.add_run(idx1, first_idx2, distances);
+            }
+            batch
+        };
+        let batches = write_and_read(&encoder, "tier0", 0, DistanceDataBatch::for_tier_runs(0), vec![
+            vec![("chr2", tier_runs(0, &[(0, 1, &[3, 0, 10]), (1, 2, &[4])])), ("chr1", tier_runs(0, &[(5, 6, &[1, 2])]))],
+            vec![("chrM", tier_runs(0, &[(9, 12, &[7, 8])]))],
+        ]);
+        assert_eq!(runs::<UInt8Type>(&batches), vec![
+            ("chr2".to_string(), 0, 1, vec![3, 0, 10]),
+            ("chr2".to_string(), 1, 1, vec![4]),
+            ("chrM".to_string(), 9, 3, vec![7, 8]),
+            ("chr1".to_string(), 5, 1, vec![1, 2]),
+        ]);
+        let batches = write_and_read(&encoder, "tier2", 2, DistanceDataBatch::for_tier_runs(2), vec![
+            vec![("chr1", tier_runs(2, &[(0, 1001, &[999, 1000, 256])]))],
+            vec![("chr2", tier_runs(2, &[(3, 1100, &[12])]))],
+        ]);
+        assert_eq!(runs::<UInt16Type>(&batches), vec![
+            ("chr1".to_string(), 0, 1001, vec![999, 1000, 256]),
+            ("chr2".to_string(), 3, 1097, vec![12]),
+        ]);
+    }
+
+    #[test]
+    fn test_parquet_row_group_per_batch() {
+        let encoder = test_encoder(vec![pair_fields()], OutputFormat::Parquet(Some(CompressionType::ZSTD)));
+        let path = std::env::temp_dir().join(format!("levx-parquet-test-{}.parquet", std::process::id()));
+        let mut file = encoder.create_output(BufWriter::new(File::create(&path).unwrap()), 0, DistanceDataBatch::new()).unwrap();
+        let row_groups = [("chr2", 4, 5), ("chrM", 9, 3)];
+        for (chrom_name, idx1, count) in row_groups {
+            let mut batch = DistanceDataBatch::new();
+            for i in 0..count {
+                batch.add(idx1 as u32, (idx1 + i + 1) as u32, (i * 300) as u16, 2);
+            }
+            file.write(&encoder.record_batch(chrom_name, batch).unwrap()).unwrap();
+        }
+        file.finish().unwrap();
+        drop(file);
+
+        let reader = SerializedFileReader::new(File::open(&path).unwrap()).unwrap();
+        let metadata = reader.metadata();
+        assert_eq!(metadata.num_row_groups(), 2);
+        for (row_group, (_, idx1, count)) in metadata.row_groups().iter().zip(row_groups) {
+            assert_eq!(row_group.num_rows(), count as i64);
+            let column = |name: &str| row_group.columns().iter().find(|column| column.column_path().string() == name).unwrap();
+            let idx2 = column("idx2");
+            assert!(idx2.encodings().contains(&Encoding::DELTA_BINARY_PACKED));
+            assert!(!idx2.encodings().contains(&Encoding::RLE_DICTIONARY));
+            for name in ["chromosome", "distance", "type"] {
+                assert!(column(name).encodings().contains(&Encoding::RLE_DICTIONARY), "{}", name);
+            }
+            assert!(matches!(idx2.compression(), Compression::ZSTD(_)));
+            let min_max = |name: &str| match column(name).statistics() {
+                Some(Statistics::Int32(statistics)) => (statistics.min_opt().copied(), statistics.max_opt().copied()),
+                other => panic!("{} has no integer statistics: {:?}", name, other),
+            };
+            // A row group holds one batch, so its statistics pin down the block of the triangle.
+            assert_eq!(min_max("idx1"), (Some(idx1), Some(idx1)));
+            assert_eq!(min_max("idx2"), (Some(idx1 + 1), Some(idx1 + count)));
+        }
+        std::fs::remove_file(&path).unwrap();
+    }
+}
@@ -0,0 +1,367 @@
+//! 2-bit packed nucleotide storage.
+//!
+//! Bases are stored 32 to a `u64` word, two bits each (A=0, C=1, G=2, T=3), at
+//! a quarter of the size of one ASCII byte per base. `N` has no code of its
+//! own: it is packed as A and recorded in a run-length mask, which stays tiny
+//! even for gap-heavy scaffolds. Windows are compared directly on the packed
+//! words where possible and unpacked to ASCII only for the DP kernels.
+
+use std::ops::Range;
+
+const BASES_PER_WORD: usize = 32;
+
+/// Low bit of every 2-bit base slot.
+const BASE_LOW_BITS: u64 = 0x5555_5555_5555_5555;
+
+/// ASCII of the four bases packed in one byte, lowest bits first.
+const fn unpack_byte_table() -> [[u8; 4]; 256] {
+    let mut table = [[0u8; 4]; 256];
+    let mut byte = 0;
+    while byte < 256 {
+        let mut slot = 0;
+        while slot < 4 {
+            table[byte][slot] = b"ACGT"[(byte >> (2 * slot)) & 3];
+            slot += 1;
+        }
+        byte += 1;
+    }
+    table
+}
+
+static UNPACK_BYTE: [[u8; 4]; 256] = unpack_byte_table();
+
+#[inline]
+fn is_n(base: u8) -> bool {
+    base & !0x20 == b'N'
+}
+
+/// Packs 32 ASCII bases into a storage word, eight at a time on the bytes of
+/// one `u64`. Also returns the slots holding an `N`.
+#[inline]
+fn pack_word(bases: &[u8; BASES_PER_WORD]) -> (u64, u32) {
+    let mut word = 0u64;
+    let mut n_slots = 0u32;
+    for (group_index, group) in bases.chunks_exact(8).enumerate() {
+        let bytes = u64::from_le_bytes(group.try_into().expect("groups are 8 bytes"));
+        // Bits 1-2 of each byte, XORed, code A, C, G and T as 0-3 and N as 0
+        // in either case; the eight codes are then gathered into 16 bits.
+        let mut codes = ((bytes >> 1) ^ (bytes >> 2)) & 0x0303_0303_0303_0303;
+        codes = (codes | codes >> 6) & 0x000F_000F_000F_000F;
+        codes = (codes | codes >> 12) & 0x0000_00FF_0000_00FF;
+        codes = (codes | codes >> 24) & 0xFFFF;
+        word |= codes << (16 * group_index);
+        // Bytes that are N in either case become zero; test for any zero byte.
+        let n_bytes = (bytes & 0xDFDF_DFDF_DFDF_DFDF) ^ 0x4E4E_4E4E_4E4E_4E4E;
+        if n_bytes.wrapping_sub(0x0101_0101_0101_0101) & !n_bytes & 0x8080_8080_8080_8080 != 0 {
+            for (slot, &base) in group.iter().enumerate() {
+                n_slots |= (is_n(base) as u32) << (8 * group_index + slot);
+            }
+        }
+    }
+    (word, n_slots)
+}
+
+/// `pack_word` for fewer than 32 bases. Zero bytes pad the rest, and pack
+/// to zero slots that are not `N`.
+#[inline]
+fn pack_partial_word(bases: &[u8]) -> (u64, u32) {
+    let mut padded = [0u8; BASES_PER_WORD];
+    padded[..bases.len()].copy_from_slice(bases);
+    pack_word(&padded)
+}
+
+/// A nucleotide sequence over `ACGTN`, 2 bits per base plus an `N` run mask.
+#[derive(Clone, Debug, Default, PartialEq, Eq)]
+pub struct PackedSequence {
+    len: usize,
+    words: Vec<u64>,
+    /// Maximal runs of `N`, sorted and disjoint.
+    n_runs: Vec<Range<usize>>,
+}
+
+impl PackedSequence {
+    #[cfg(test)]
+    pub fn from_ascii(seq: &[u8]) -> Self {
+        let mut packed = PackedSequence::default();
+        packed.extend_from_ascii(seq);
+        packed
+    }
+
+    /// Appends bases given as ASCII `A`, `C`, `G`, `T` or `N` in either case,
+    /// a storage word at a time. Other bytes get an arbitrary code.
+    pub fn extend_from_ascii(&mut self, bases: &[u8]) {
+        for chunk in bases.chunks(BASES_PER_WORD) {
+            let (word, mut n_slots) = match chunk.first_chunk() {
+                Some(full) => pack_word(full),
+                None => pack_partial_word(chunk),
+            };
+            while n_slots != 0 {
+                self.mark_n(self.len + n_slots.trailing_zeros() as usize);
+                n_slots &= n_slots - 1;
+            }
+            self.append_word(word, chunk.len());
+        }
+    }
+
+    /// Appends `len` bases already packed like storage words; slots past
+    /// `len` in the last word are ignored.
+    pub fn extend_from_words(&mut self, words: &[u64], len: usize) {
+        let full_words = len / BASES_PER_WORD;
+        if self.len % BASES_PER_WORD == 0 {
+            self.words.extend_from_slice(&words[..full_words]);
+            self.len += full_words * BASES_PER_WORD;
+        } else {
+            for &word in &words[..full_words] {
+                self.append_word(word, BASES_PER_WORD);
+            }
+        }
+        let rest = len % BASES_PER_WORD;
+        if rest > 0 {
+            self.append_word(words[full_words] & ((1u64 << (2 * rest)) - 1), rest);
+        }
+    }
+
+    /// Marks `range`, which must not start before the end of the last run,
+    /// as `N`. Its bases are re-coded as A, as `extend_from_ascii` packs them.
+    pub fn add_n_run(&mut self, range: Range<usize>) {
+        let mut pos = range.start;
+        while pos < range.end {
+            let slot = pos % BASES_PER_WORD;
+            let count = (BASES_PER_WORD - slot).min(range.end - pos);
+            let mask = if count == BASES_PER_WORD { !0 } else { ((1u64 << (2 * count)) - 1) << (2 * slot) };
+            self.words[pos / BASES_PER_WORD] &= !mask;
+            pos += count;
+        }
+        match self.n_runs.last_mut() {
+            _ if range.is_empty() => {}
+            Some(run) if run.end >= range.start => run.end = run.end.max(range.end),
+            _ => self.n_runs.push(range),
+        }
+    }
+
+    /// Appends `count` bases packed like a storage word, with the slots past
+    /// `count` zero.
+    #[inline]
+    fn append_word(&mut self, word: u64, count: usize) {
+        let slot = self.len % BASES_PER_WORD;
+        if slot == 0 {
+            self.words.push(word);
+        } else {
+            *self.words.last_mut().expect("a partial word is stored") |= word << (2 * slot);
+            if slot + count > BASES_PER_WORD {
+                self.words.push(word >> (64 - 2 * slot));
+            }
+        }
+        self.len += count;
+    }
+
+    /// Adds position `pos`, at or past the end of every run so far, to the `N` mask.
+    #[inline]
+    fn mark_n(&mut self, pos: usize) {
+        match self.n_runs.last_mut() {
+            Some(run) if run.end == pos => run.end += 1,
+            _ => self.n_runs.push(pos..pos + 1),
+        }
+    }
+
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    pub fn shrink_to_fit(&mut self) {
+        self.words.shrink_to_fit();
+        self.n_runs.shrink_to_fit();
+    }
+
+    /// The 32 bases starting at `pos`, packed like a storage word; slots past
+    /// the end of the sequence read as 0.
+    #[inline]
+    fn word_at(&self, pos: usize) -> u64 {
+        let index = pos / BASES_PER_WORD;
+        let shift = 2 * (pos % BASES_PER_WORD);
+        let mut word = self.words[index] >> shift;
+        if shift > 0 {
+            if let Some(next) = self.words.get(index + 1) {
+                word |= next << (64 - shift);
+            }
+        }
+        word
+    }
+
+    /// `N` runs that overlap `range`.
+    fn n_runs_in(&self, range: &Range<usize>) -> &[Range<usize>] {
+        let first = self.n_runs.partition_point(|run| run.end <= range.start);
+        let last = self.n_runs.partition_point(|run| run.start < range.end);
+        &self.n_runs[first..last.max(first)]
+    }
+
+    pub fn count_n(&self, range: Range<usize>) -> usize {
+        self.n_runs_in(&range).iter().map(|run| run.end.min(range.end) - run.start.max(range.start)).sum()
+    }
+
+    pub fn has_n(&self, range: Range<usize>) -> bool {
+        !self.n_runs_in(&range).is_empty()
+    }
+
+    /// Whether `range` is non-empty and made only of `N`. Runs are maximal,
+    /// so such a range lies within a single run.
+    pub fn is_all_n(&self, range: Range<usize>) -> bool {
+        !range.is_empty() && self.n_runs_in(&range).first().is_some_and(|run| run.start <= range.start && run.end >= range.end)
+    }
+
+    /// Replaces the contents of `out` with the ASCII bases of `range`.
+    pub fn unpack_into(&self, range: Range<usize>, out: &mut Vec<u8>) {
+        out.clear();
+        out.reserve(range.len() + BASES_PER_WORD);
+        let mut pos = range.start;
+        while pos < range.end {
+            for byte in self.word_at(pos).to_le_bytes() {
+                out.extend_from_slice(&UNPACK_BYTE[byte as usize]);
+            }
+            pos += BASES_PER_WORD;
+        }
+        out.truncate(range.len());
+        for run in self.n_runs_in(&range) {
+            out[run.start.max(range.start) - range.start..run.end.min(range.end) - range.start].fill(b'N');
+        }
+    }
+
+    pub fn to_ascii(&self, range: Range<usize>) -> Vec<u8> {
+        let mut out = Vec::new();
+        self.unpack_into(range, &mut out);
+        out
+    }
+
+    /// Mismatching positions between the `len`-base ranges at `a` and `b`, 32
+    /// bases per XOR. Ranges touching an `N` are compared unpacked, since `N`
+    /// shares its code with `A`.
+    pub fn hamming(&self, a: usize, b: usize, len: usize) -> usize {
+        if self.has_n(a..a + len) || self.has_n(b..b + len) {
+            let (seq_a, seq_b) = (self.to_ascii(a..a + len), self.to_ascii(b..b + len));
+            return seq_a.iter().zip(&seq_b).filter(|(x, y)| x != y).count();
+        }
+        let mut mismatches = 0;
+        let mut offset = 0;
+        while offset < len {
+            let mut diff = self.word_at(a + offset) ^ self.word_at(b + offset);
+            let remaining = len - offset;
+            if remaining < BASES_PER_WORD {
+                diff &= (1u64 << (2 * remaining)) - 1;
+            }
+            mismatches += ((diff | (diff >> 1)) & BASE_LOW_BITS).count_ones() as usize;
+            offset += BASES_PER_WORD;
+        }
+        mismatches
+    }
+
+    /// A key that is equal for two ranges exactly when their bases are: the
+    /// packed words followed by the `N` runs relative to the range start.
+    pub fn range_key(&self, range: Range<usize>) -> Vec<u64> {
+        let mut key = Vec::with_capacity(range.len().div_ceil(BASES_PER_WORD));
+        let mut pos = range.start;
+        while pos < range.end {
+            let remaining = range.end - pos;
+            let word = self.word_at(pos);
+            key.push(if remaining < BASES_PER_WORD { word & ((1u64 << (2 * remaining)) - 1) } else { word });
+            pos += BASES_PER_WORD;
+        }
+        for run in self.n_runs_in(&range) {
+            let (start, end) = (run.start.max(range.start) - range.start, run.end.min(range.end) - range.start);
+            key.push(((start as u64) << 32) | end as u64);
+        }
+        key
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn random_acgtn(seed: &mut u64, len: usize) -> Vec<u8> {
+        (0..len)
+            .map(|_| {
+                *seed = seed.wrapping_mul(6364136223846793005).wrapping_add(1442695040888963407);
+                // Mostly ACGT, with occasional N runs.
+                let r = (*seed >> 33) % 40;
+                if r < 2 { b'N' } else { b"ACGT"[(r % 4) as usize] }
+            })
+            .collect()
+    }
+
+    #[test]
+    fn test_pack_round_trip() {
+        let mut seed = 3;
+        for len in [0, 1, 31, 32, 33, 100, 1000] {
+            let ascii = random_acgtn(&mut seed, len);
+            let packed = PackedSequence::from_ascii(&ascii);
+            assert_eq!(packed.len(), len);
+            let mut extended = PackedSequence::default();
+            for piece in ascii.chunks(45) {
+                extended.extend_from_ascii(&piece.to_ascii_lowercase());
+            }
+            assert_eq!(extended, packed);
+            assert_eq!(packed.to_ascii(0..len), ascii);
+            for start in [0, 1, 5, 31, 40] {
+                if start < len {
+                    assert_eq!(packed.to_ascii(start..len), &ascii[start..]);
+                    assert_eq!(packed.count_n(start..len), ascii[start..].iter().filter(|&&b| b == b'N').count());
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn test_extend_from_words() {
+        let mut seed = 11;
+        let ascii = random_acgtn(&mut seed, 200);
+        let source = PackedSequence::from_ascii(&ascii);
+        // Appended at an unaligned position, with the N runs added afterwards.
+        let mut packed = PackedSequence::from_ascii(b"GAT");
+        packed.extend_from_words(&source.words, 200);
+        for run in &source.n_runs {
+            packed.add_n_run(run.start + 3..run.end + 3);
+        }
+        let mut expected = b"GAT".to_vec();
+        expected.extend_from_slice(&ascii);
+        assert_eq!(packed, PackedSequence::from_ascii(&expected));
+    }
+
+    #[test]
+    fn test_n_mask() {
+        let packed = PackedSequence::from_ascii(b"ACNNNNGTNA");
+        assert_eq!(packed.n_runs, vec![2..6, 8..9]);
+        assert!(packed.is_all_n(2..6));
+        assert!(packed.is_all_n(3..5));
+        assert!(!packed.is_all_n(1..5));
+        assert!(!packed.has_n(6..8));
+        assert_eq!(packed.count_n(0..10), 5);
+    }
+
+    #[test]
+    fn test_packed_hamming_and_keys() {
+        let mut seed = 7;
+        let mut ascii = random_acgtn(&mut seed, 3000);
+        // A copy of the first window with two substitutions, and an exact copy.
+        let copy: Vec<u8> = ascii[..1000].to_vec();
+        ascii[1000..2000].copy_from_slice(&copy);
+        ascii[1010] = if ascii[1010] == b'A' { b'C' } else { b'A' };
+        ascii[1999] = if ascii[1999] == b'T' { b'G' } else { b'T' };
+        ascii[2000..3000].copy_from_slice(&copy);
+        let packed = PackedSequence::from_ascii(&ascii);
+        for (a, b, len) in [(0, 1000, 1000), (0, 2000, 1000), (7, 1500, 777), (0, 2000, 33)] {
+            let expected = ascii[a..a + len].iter().zip(&ascii[b..b + len]).filter(|(x, y)| x != y).count();
+            assert_eq!(packed.hamming(a, b, len), expected);
+        }
+        // N-free ranges take the packed path.
+        let clean_ascii: Vec<u8> = ascii.iter().map(|&b| if b == b'N' { b'A' } else { b }).collect();
+        let clean = PackedSequence::from_ascii(&clean_ascii);
+        let expected = clean_ascii[..1000].iter().zip(&clean_ascii[1000..2000]).filter(|(x, y)| x != y).count();
+        assert!(expected > 0);
+        assert_eq!(clean.hamming(0, 1000, 1000), expected);
+        assert_eq!(packed.range_key(0..1000), packed.range_key(2000..3000));
+        assert_ne!(packed.range_key(0..1000), packed.range_key(1000..2000));
+        // An N and an A pack to the same code but give different keys.
+        let n_vs_a = PackedSequence::from_ascii(b"ACGNACGA");
+        assert_ne!(n_vs_a.range_key(0..4), n_vs_a.range_key(4..8));
+    }
+}
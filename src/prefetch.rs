@@ -0,0 +1,189 @@
+//! Loading waves of chromosomes ahead of the computation.
+//!
+//! A loader thread reads the next waves while the current one is computed, so
+//! that parsing and decompression overlap the distance kernels. It starts a
+//! wave only while fewer than `depth` + 1 waves are loaded and not yet
+//! finished, and while they fit in a memory budget with the new one. Waves
+//! still finishing count, so a consumer that overlaps waves cannot let the
+//! loader run further ahead. A wave may always be loaded when no other is
+//! held, so one larger than the budget still goes through, alone.
+
+use crate::fasta_index::{ChromosomeSource, Wave};
+use crossbeam_channel::{bounded, Receiver};
+use std::io::Error;
+use std::sync::{Arc, Condvar, Mutex};
+use std::thread::Scope;
+
+struct BudgetState {
+    used: usize,
+    /// Waves holding a reservation.
+    waves: usize,
+    /// Set when the consumer stops taking waves.
+    closed: bool,
+}
+
+/// Bytes and waves held by loaded waves, shared by the loader and the consumer.
+struct MemoryBudget {
+    limit: usize,
+    /// Waves that may be held besides the oldest one.
+    depth: usize,
+    state: Mutex<BudgetState>,
+    released: Condvar,
+}
+
+impl MemoryBudget {
+    /// Waits until another wave of `bytes` fits in the budget and the depth,
+    /// or nothing else is held, and reserves them; `None` once the consumer
+    /// has stopped.
+    fn reserve(self: &Arc<Self>, bytes: usize) -> Option<Reservation> {
+        let mut state = self.state.lock().expect("memory budget lock poisoned");
+        while !state.closed && state.waves > 0 && (state.waves > self.depth || state.used + bytes > self.limit) {
+            state = self.released.wait(state).expect("memory budget lock poisoned");
+        }
+        if state.closed {
+            return None;
+        }
+        state.used += bytes;
+        state.waves += 1;
+        Some(Reservation { budget: self.clone(), bytes })
+    }
+
+    fn close(&self) {
+        self.state.lock().expect("memory budget lock poisoned").closed = true;
+        self.released.notify_all();
+    }
+}
+
+/// The memory held by one loaded wave, given back to the budget when dropped.
+pub struct Reservation {
+    budget: Arc<MemoryBudget>,
+    bytes: usize,
+}
+
+impl Drop for Reservation {
+    fn drop(&mut self) {
+        let mut state = self.budget.state.lock().expect("memory budget lock poisoned");
+        state.used -= self.bytes;
+        state.waves -= 1;
+        drop(state);
+        self.budget.released.notify_all();
+    }
+}
+
+/// The loaded waves, in order. Each one's reservation should be dropped once
+/// its sequence is no longer used.
+pub struct Prefetcher {
+    waves: Receiver<Result<(Wave, Reservation), Error>>,
+    budget: Arc<MemoryBudget>,
+}
+
+impl Iterator for Prefetcher {
+    type Item = Result<(Wave, Reservation), Error>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        self.waves.recv().ok()
+    }
+}
+
+impl Drop for Prefetcher {
+    fn drop(&mut self) {
+        // Wakes a loader waiting for memory; one blocked on the channel stops when it closes.
+        self.budget.close();
+    }
+}
+
+/// Starts loading the waves of `source` on a thread of `scope`, at most `depth`
+/// waves ahead of the oldest one not yet released and within `budget_bytes`
+/// of packed sequence. With a depth of 0 a wave is only loaded once the
+/// previous one is released.
+pub fn prefetch_waves<'scope, 'env>(
+    scope: &'scope Scope<'scope, 'env>,
+    source: &'env ChromosomeSource,
+    wave_bases: usize,
+    depth: usize,
+    budget_bytes: usize,
+) -> Prefetcher {
+    let budget = Arc::new(MemoryBudget {
+        limit: budget_bytes,
+        depth,
+        state: Mutex::new(BudgetState { used: 0, waves: 0, closed: false }),
+        released: Condvar::new(),
+    });
+    // The loader holds one more wave while it waits to hand it over.
+    let (tx, rx) = bounded(depth.saturating_sub(1));
+    let loader_budget = budget.clone();
+    scope.spawn(move || {
+        for wave in source.plan_waves(wave_bases) {
+            let Some(reservation) = loader_budget.reserve(source.wave_bytes(wave.clone())) else {
+                return;
+            };
+            let loaded = source.load_wave(wave).map(|loaded| (loaded, reservation));
+            let failed = loaded.is_err();
+            if tx.send(loaded).is_err() || failed {
+                return;
+            }
+        }
+    });
+    Prefetcher { waves: rx, budget }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn new_budget(limit: usize, depth: usize) -> Arc<MemoryBudget> {
+        Arc::new(MemoryBudget { limit, depth, state: Mutex::new(BudgetState { used: 0, waves: 0, closed: false }), released: Condvar::new() })
+    }
+
+    #[test]
+    fn test_budget_blocks_until_released() {
+        let budget = new_budget(10, 4);
+        let first = budget.reserve(8).unwrap();
+        // Over budget: the second reservation waits for the first to be dropped.
+        std::thread::scope(|scope| {
+            let waiter = scope.spawn(|| budget.reserve(8).map(|reservation| reservation.bytes));
+            std::thread::sleep(std::time::Duration::from_millis(20));
+            assert!(!waiter.is_finished());
+            drop(first);
+            assert_eq!(waiter.join().unwrap(), Some(8));
+        });
+        // Nothing held: larger than the whole budget still goes through.
+        let large = budget.reserve(50).unwrap();
+        std::thread::scope(|scope| {
+            let waiter = scope.spawn(|| budget.reserve(1).is_none());
+            budget.close();
+            assert!(waiter.join().unwrap());
+        });
+        drop(large);
+        assert_eq!(budget.state.lock().unwrap().used, 0);
+    }
+
+    #[test]
+    fn test_depth_limits_held_waves() {
+        // Depth 1: the oldest wave and one more, however much memory is left.
+        let budget = new_budget(100, 1);
+        let first = budget.reserve(1).unwrap();
+        let second = budget.reserve(1).unwrap();
+        std::thread::scope(|scope| {
+            let waiter = scope.spawn(|| budget.reserve(1).map(|reservation| reservation.bytes));
+            std::thread::sleep(std::time::Duration::from_millis(20));
+            assert!(!waiter.is_finished());
+            drop(first);
+            assert_eq!(waiter.join().unwrap(), Some(1));
+        });
+        drop(second);
+
+        // Depth 0: one wave at a time.
+        let budget = new_budget(100, 0);
+        let only = budget.reserve(1).unwrap();
+        std::thread::scope(|scope| {
+            let waiter = scope.spawn(|| budget.reserve(1).is_some());
+            std::thread::sleep(std::time::Duration::from_millis(20));
+            assert!(!waiter.is_finished());
+            drop(only);
+            assert!(waiter.join().unwrap());
+        });
+        let state = budget.state.lock().unwrap();
+        assert_eq!((state.used, state.waves), (0, 0));
+    }
+}
@@ -0,0 +1,229 @@
+//! Decomposition of every chromosome's pair triangle into schedulable tasks.
+//!
+//! The pairs (idx1, idx2) with idx1 < idx2 of a chromosome form an upper
+//! triangle whose rows shrink from n-1 pairs to 1, and a single row streams
+//! every window of the chromosome through cache. Square tiles of
+//! `TILE_GRID_POINTS` x `TILE_GRID_POINTS` grid points bound both: a tile
+//! touches at most twice that many windows. Consecutive tiles of one tile row
+//! are bundled into tasks of roughly equal estimated cost, contigs that fit in
+//! a single tile are bundled with each other, and the tasks of all chromosomes
+//! of a wave are handed out most expensive first. The next wave's tasks are
+//! queued while the cheap tail of the current one runs, so the work-stealing
+//! pool stays saturated until the very end of the genome.
+
+use std::ops::Range;
+
+/// Grid points per tile side. With 1 kb windows a tile reads 2 x 128 x 1 kb =
+/// 256 KB of sequence, which stays in L2 next to the kernels' own state.
+pub const TILE_GRID_POINTS: usize = 128;
+
+/// Tasks aim for the cost of this many full far-tier tiles: enough work to
+/// amortize scheduling, and still tens of thousands of tasks per large
+/// chromosome to balance over many cores.
+const TASK_TARGET_TILES: u64 = 16;
+
+/// One block of a pair triangle.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct Tile {
+    idx1_block: u32,
+    idx2_block: u32,
+}
+
+impl Tile {
+    pub fn idx1_range(&self, num_grid_points: usize) -> Range<usize> {
+        block_range(self.idx1_block as usize, num_grid_points)
+    }
+
+    /// The idx2 range the row `idx1` of this tile covers; empty when the row
+    /// has no pair in the tile.
+    pub fn idx2_range_for_row(&self, idx1: usize, num_grid_points: usize) -> Range<usize> {
+        let block = block_range(self.idx2_block as usize, num_grid_points);
+        let start = block.start.max(idx1 + 1);
+        start..block.end.max(start)
+    }
+}
+
+fn block_range(block: usize, num_grid_points: usize) -> Range<usize> {
+    let start = block * TILE_GRID_POINTS;
+    start..(start + TILE_GRID_POINTS).min(num_grid_points)
+}
+
+/// Tier-weighted cost of the pairs of row `idx1` against `idx2_range`.
+/// `tier_max_offsets[t]` is the largest idx2 - idx1 that still falls in tier
+/// `t`; offsets past the last one fall in the final tier.
+/// `pair_costs` holds one relative per-pair cost per tier.
+fn row_segment_cost(idx1: usize, idx2_range: Range<usize>, tier_max_offsets: &[usize], pair_costs: &[u64]) -> u64 {
+    let mut cost = 0;
+    let mut tier_start = 1;
+    for (tier, &pair_cost) in pair_costs.iter().enumerate() {
+        let tier_end = tier_max_offsets.get(tier).map_or(usize::MAX, |&max_offset| idx1 + max_offset + 1);
+        let start = idx2_range.start.max(idx1 + tier_start);
+        let end = idx2_range.end.min(tier_end);
+        if end > start {
+            cost += (end - start) as u64 * pair_cost;
+        }
+        tier_start = tier_end - idx1;
+        if tier_end >= idx2_range.end {
+            break;
+        }
+    }
+    cost
+}
+
+/// Tier-weighted cost of all pairs of `tile`.
+fn tile_cost(tile: &Tile, num_grid_points: usize, tier_max_offsets: &[usize], pair_costs: &[u64]) -> u64 {
+    let far_offset = tier_max_offsets.last().copied().unwrap_or(0);
+    let far_cost = pair_costs.last().copied().unwrap_or(1);
+    let idx1_range = tile.idx1_range(num_grid_points);
+    let idx2_block_range = block_range(tile.idx2_block as usize, num_grid_points);
+    // Off-diagonal tiles entirely past the last tier boundary are the common case.
+    if tile.idx2_block > tile.idx1_block && idx2_block_range.start - (idx1_range.end - 1) > far_offset {
+        (idx1_range.len() * idx2_block_range.len()) as u64 * far_cost
+    } else {
+        idx1_range
+            .map(|idx1| row_segment_cost(idx1, tile.idx2_range_for_row(idx1, num_grid_points), tier_max_offsets, pair_costs))
+            .sum()
+    }
+}
+
+/// A unit of work handed to the pool.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub enum TaskKind {
+    /// Consecutive tiles of one tile row of a job.
+    Tiles { job: u32, idx1_block: u32, idx2_blocks: Range<u32> },
+    /// Every pair of several jobs that each fit in a single tile.
+    SmallJobs { jobs: Vec<u32> },
+}
+
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct Task {
+    pub kind: TaskKind,
+    pub cost: u64,
+}
+
+impl Task {
+    /// The tiles of the task and the job each belongs to, in processing order.
+    pub fn tiles(&self) -> Vec<(usize, Tile)> {
+        match &self.kind {
+            TaskKind::Tiles { job, idx1_block, idx2_blocks } => idx2_blocks
+                .clone()
+                .map(|idx2_block| (*job as usize, Tile { idx1_block: *idx1_block, idx2_block }))
+                .collect(),
+            TaskKind::SmallJobs { jobs } => jobs.iter().map(|&job| (job as usize, Tile { idx1_block: 0, idx2_block: 0 })).collect(),
+        }
+    }
+
+    /// Jobs with at least one tile in this task.
+    pub fn jobs(&self) -> Vec<usize> {
+        match &self.kind {
+            TaskKind::Tiles { job, .. } => vec![*job as usize],
+            TaskKind::SmallJobs { jobs } => jobs.iter().map(|&job| job as usize).collect(),
+        }
+    }
+}
+
+/// Splits the pair triangles of all jobs, given as their numbers of grid
+/// points, into tasks ordered by decreasing estimated cost.
+pub fn plan_tasks(job_grid_points: &[usize], tier_max_offsets: &[usize], pair_costs: &[u64]) -> Vec<Task> {
+    let far_cost = pair_costs.last().copied().unwrap_or(1);
+    let target_cost = TASK_TARGET_TILES * (TILE_GRID_POINTS * TILE_GRID_POINTS) as u64 * far_cost;
+    let mut tasks = Vec::new();
+    let mut small_jobs = Vec::new();
+    let mut small_jobs_cost = 0;
+    for (job, &num_grid_points) in job_grid_points.iter().enumerate() {
+        if num_grid_points < 2 {
+            continue;
+        }
+        if num_grid_points <= TILE_GRID_POINTS {
+            small_jobs.push(job as u32);
+            small_jobs_cost += tile_cost(&Tile { idx1_block: 0, idx2_block: 0 }, num_grid_points, tier_max_offsets, pair_costs);
+            if small_jobs_cost >= target_cost {
+                tasks.push(Task { kind: TaskKind::SmallJobs { jobs: std::mem::take(&mut small_jobs) }, cost: small_jobs_cost });
+                small_jobs_cost = 0;
+            }
+            continue;
+        }
+        let num_blocks = num_grid_points.div_ceil(TILE_GRID_POINTS) as u32;
+        for idx1_block in 0..num_blocks {
+            let mut span_start = idx1_block;
+            let mut span_cost = 0;
+            for idx2_block in idx1_block..num_blocks {
+                span_cost += tile_cost(&Tile { idx1_block, idx2_block }, num_grid_points, tier_max_offsets, pair_costs);
+                if span_cost >= target_cost || idx2_block + 1 == num_blocks {
+                    if span_cost > 0 {
+                        let kind = TaskKind::Tiles { job: job as u32, idx1_block, idx2_blocks: span_start..idx2_block + 1 };
+                        tasks.push(Task { kind, cost: span_cost });
+                    }
+                    span_start = idx2_block + 1;
+                    span_cost = 0;
+                }
+            }
+        }
+    }
+    if !small_jobs.is_empty() {
+        tasks.push(Task { kind: TaskKind::SmallJobs { jobs: small_jobs }, cost: small_jobs_cost });
+    }
+    tasks.sort_unstable_by(|a, b| b.cost.cmp(&a.cost));
+    tasks
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const TIER_MAX_OFFSETS: [usize; 2] = [2, 40];
+    const PAIR_COSTS: [u64; 3] = [1, 5, 100];
+
+    #[test]
+    fn test_tasks_cover_every_triangle_once() {
+        let job_grid_points = [3 * TILE_GRID_POINTS + 17, 1, 5, TILE_GRID_POINTS, 40 * TILE_GRID_POINTS, 2];
+        let mut seen: Vec<Vec<bool>> = job_grid_points.iter().map(|&n| vec![false; n * n]).collect();
+        let mut covered = vec![0usize; job_grid_points.len()];
+        let tasks = plan_tasks(&job_grid_points, &TIER_MAX_OFFSETS, &PAIR_COSTS);
+        for task in &tasks {
+            for (job, tile) in task.tiles() {
+                let n = job_grid_points[job];
+                for idx1 in tile.idx1_range(n) {
+                    for idx2 in tile.idx2_range_for_row(idx1, n) {
+                        assert!(idx1 < idx2);
+                        assert!(!seen[job][idx1 * n + idx2]);
+                        seen[job][idx1 * n + idx2] = true;
+                        covered[job] += 1;
+                    }
+                }
+            }
+        }
+        for (&n, &pairs) in job_grid_points.iter().zip(&covered) {
+            assert_eq!(pairs, n * n.saturating_sub(1) / 2);
+        }
+        // The three single-tile contigs share one task.
+        let small: Vec<_> = tasks.iter().filter(|task| matches!(task.kind, TaskKind::SmallJobs { .. })).collect();
+        assert_eq!(small.len(), 1);
+        assert_eq!(small[0].jobs(), vec![2, 3, 5]);
+    }
+
+    #[test]
+    fn test_task_costs_are_tier_weighted_and_sorted() {
+        // Offsets 1..=2 cost 1, 3..=40 cost 5, beyond cost 100.
+        assert_eq!(row_segment_cost(10, 11..13, &TIER_MAX_OFFSETS, &PAIR_COSTS), 2);
+        assert_eq!(row_segment_cost(10, 11..51, &TIER_MAX_OFFSETS, &PAIR_COSTS), 2 + 38 * 5);
+        assert_eq!(row_segment_cost(10, 49..53, &TIER_MAX_OFFSETS, &PAIR_COSTS), 2 * 5 + 2 * 100);
+        assert_eq!(row_segment_cost(10, 60..70, &TIER_MAX_OFFSETS, &PAIR_COSTS), 10 * 100);
+
+        let num_grid_points = 40 * TILE_GRID_POINTS;
+        let tasks = plan_tasks(&[num_grid_points], &TIER_MAX_OFFSETS, &PAIR_COSTS);
+        assert!(tasks.windows(2).all(|pair| pair[0].cost >= pair[1].cost));
+        for task in &tasks {
+            let expected: u64 = task
+                .tiles()
+                .iter()
+                .flat_map(|(_, tile)| tile.idx1_range(num_grid_points).map(move |idx1| (idx1, *tile)))
+                .map(|(idx1, tile)| row_segment_cost(idx1, tile.idx2_range_for_row(idx1, num_grid_points), &TIER_MAX_OFFSETS, &PAIR_COSTS))
+                .sum();
+            assert_eq!(task.cost, expected);
+        }
+        // Spans close as soon as they reach the target cost.
+        let full_tile_cost = (TILE_GRID_POINTS * TILE_GRID_POINTS) as u64 * PAIR_COSTS[2];
+        assert!(tasks[0].cost < (TASK_TARGET_TILES + 1) * full_tile_cost);
+    }
+}
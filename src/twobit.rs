@@ -0,0 +1,290 @@
+//! UCSC `.2bit` input.
+//!
+//! A `.2bit` file already stores every sequence at two bits per base, with its
+//! `N` blocks listed apart from the bases, so it maps onto the packed store
+//! without any parsing: the bases are re-coded a byte at a time through a
+//! table, and the `N` blocks become the run mask. The file is memory-mapped
+//! and its own index locates each sequence by name, so opening one only reads
+//! that index, and a sequence is read only when it is loaded. Soft-mask blocks
+//! are ignored, like lowercase bases in FASTA.
+
+use crate::fasta_parser;
+use crate::genome::Genome;
+use memmap2::Mmap;
+use std::collections::HashMap;
+use std::fs::File;
+use std::io::{Error, ErrorKind};
+
+const SIGNATURE: u32 = 0x1A41_2743;
+
+/// Packed sequence words re-coded per batch.
+const STAGED_WORDS: usize = 1 << 12;
+
+/// One `.2bit` byte (four bases, T=0 C=1 A=2 G=3, first base in the high
+/// bits) re-coded for the packed store (A=0 C=1 G=2 T=3, first base in the low bits).
+const fn recode_table() -> [u8; 256] {
+    const CODES: [u8; 4] = [3, 1, 0, 2];
+    let mut table = [0u8; 256];
+    let mut byte = 0;
+    while byte < 256 {
+        let mut slot = 0;
+        while slot < 4 {
+            table[byte] |= CODES[(byte >> (6 - 2 * slot)) & 3] << (2 * slot);
+            slot += 1;
+        }
+        byte += 1;
+    }
+    table
+}
+
+static RECODE: [u8; 256] = recode_table();
+
+/// Byte order and offset width of a `.2bit` file.
+#[derive(Clone, Copy)]
+struct Layout {
+    big_endian: bool,
+    /// Version 1 files use 64-bit record offsets.
+    wide_offsets: bool,
+}
+
+impl Layout {
+    fn u32_at(&self, data: &[u8], pos: usize) -> Result<u32, Error> {
+        let bytes: [u8; 4] = data.get(pos..pos + 4).and_then(|bytes| bytes.try_into().ok()).ok_or_else(truncated)?;
+        Ok(if self.big_endian { u32::from_be_bytes(bytes) } else { u32::from_le_bytes(bytes) })
+    }
+
+    fn offset_at(&self, data: &[u8], pos: usize) -> Result<usize, Error> {
+        if !self.wide_offsets {
+            return Ok(self.u32_at(data, pos)? as usize);
+        }
+        let (first, second) = (self.u32_at(data, pos)? as u64, self.u32_at(data, pos + 4)? as u64);
+        Ok((if self.big_endian { first << 32 | second } else { second << 32 | first }) as usize)
+    }
+}
+
+fn truncated() -> Error {
+    Error::new(ErrorKind::UnexpectedEof, "truncated .2bit file")
+}
+
+/// A sequence listed in the index of a `.2bit` file.
+#[derive(Clone, Debug)]
+pub struct TwoBitRecord {
+    pub name: String,
+    /// Number of bases.
+    pub len: usize,
+    /// Offset of the sequence record.
+    offset: usize,
+}
+
+/// Reads the header and sequence index, and the length of every sequence.
+fn read_index(data: &[u8]) -> Result<(Layout, Vec<TwoBitRecord>), Error> {
+    let signature = data.get(..4).map(|bytes| u32::from_le_bytes(bytes.try_into().expect("4 bytes")));
+    let big_endian = match signature {
+        Some(SIGNATURE) => false,
+        Some(swapped) if swapped.swap_bytes() == SIGNATURE => true,
+        _ => return Err(Error::new(ErrorKind::InvalidData, "not a .2bit file (bad signature)")),
+    };
+    let mut layout = Layout { big_endian, wide_offsets: false };
+    layout.wide_offsets = match layout.u32_at(data, 4)? {
+        0 => false,
+        1 => true,
+        version => return Err(Error::new(ErrorKind::InvalidData, format!("unsupported .2bit version {}", version))),
+    };
+    let count = layout.u32_at(data, 8)? as usize;
+    let mut records = Vec::with_capacity(count);
+    let mut pos = 16;
+    for _ in 0..count {
+        let name_len = *data.get(pos).ok_or_else(truncated)? as usize;
+        let name = data.get(pos + 1..pos + 1 + name_len).ok_or_else(truncated)?;
+        let name = String::from_utf8(name.to_vec()).map_err(|_| Error::new(ErrorKind::InvalidData, "non-UTF-8 sequence name in .2bit file"))?;
+        pos += 1 + name_len;
+        let offset = layout.offset_at(data, pos)?;
+        pos += if layout.wide_offsets { 8 } else { 4 };
+        let len = layout.u32_at(data, offset)? as usize;
+        records.push(TwoBitRecord { name, len, offset });
+    }
+    Ok((layout, records))
+}
+
+/// Appends the sequence of `record` to `genome` as a contig.
+fn read_record(data: &[u8], layout: Layout, record: &TwoBitRecord, genome: &mut Genome) -> Result<(), Error> {
+    let invalid = || Error::new(ErrorKind::InvalidData, format!("invalid N blocks in .2bit sequence '{}'", record.name));
+    let n_count = layout.u32_at(data, record.offset + 4)? as usize;
+    let n_starts = record.offset + 8;
+    let n_sizes = n_starts + 4 * n_count;
+    let mut n_blocks = Vec::with_capacity(n_count);
+    for block in 0..n_count {
+        let start = layout.u32_at(data, n_starts + 4 * block)? as usize;
+        let size = layout.u32_at(data, n_sizes + 4 * block)? as usize;
+        n_blocks.push(start..start.checked_add(size).filter(|&end| end <= record.len).ok_or_else(invalid)?);
+    }
+    n_blocks.sort_unstable_by_key(|block| block.start);
+    let mask_count = layout.u32_at(data, n_sizes + 4 * n_count)? as usize;
+    // Past the mask blocks and a reserved word.
+    let bases_start = n_sizes + 4 * n_count + 4 + 8 * mask_count + 4;
+    let bases = data.get(bases_start..bases_start + record.len.div_ceil(4)).ok_or_else(truncated)?;
+
+    genome.begin_contig(record.name.clone());
+    let mut staged = [0u64; STAGED_WORDS];
+    let mut remaining = record.len;
+    for chunk in bases.chunks(8 * STAGED_WORDS) {
+        let mut words = 0;
+        for group in chunk.chunks(8) {
+            let mut recoded = [0u8; 8];
+            for (out, &byte) in recoded.iter_mut().zip(group) {
+                *out = RECODE[byte as usize];
+            }
+            staged[words] = u64::from_le_bytes(recoded);
+            words += 1;
+        }
+        let count = remaining.min(32 * words);
+        genome.push_packed(&staged[..words], count);
+        remaining -= count;
+    }
+    let mut marked_end = 0;
+    for block in n_blocks {
+        // Overlapping blocks are merged by marking only what is past the last one.
+        genome.mark_n_run(block.start.max(marked_end)..block.end.max(marked_end));
+        marked_end = marked_end.max(block.end);
+    }
+    Ok(())
+}
+
+/// A memory-mapped `.2bit` file and its sequence index.
+pub struct TwoBitFile {
+    path: String,
+    data: Mmap,
+    layout: Layout,
+    records: Vec<TwoBitRecord>,
+    by_name: HashMap<String, usize>,
+}
+
+impl TwoBitFile {
+    /// Maps `path` and reads its index. Empty sequences are skipped with a warning.
+    pub fn open(path: &str) -> Result<Self, Error> {
+        let file = File::open(path).map_err(|e| Error::new(e.kind(), format!("Failed to open .2bit file '{}': {}", path, e)))?;
+        let data = fasta_parser::map_file(&file, path)?;
+        let (layout, records) = read_index(&data).map_err(|e| Error::new(e.kind(), format!("Error reading '{}': {}", path, e)))?;
+        let mut by_name = HashMap::with_capacity(records.len());
+        let records: Vec<TwoBitRecord> = records.into_iter().filter(|record| {
+            if record.len == 0 {
+                eprintln!("Warning: Chromosome/sequence entry '{}' in file '{}' had no sequence data. Skipping.", record.name, path);
+                return false;
+            }
+            if by_name.contains_key(&record.name) {
+                eprintln!("Warning: Chromosome name '{}' appears more than once in '{}'; keeping the first.", record.name, path);
+                return false;
+            }
+            by_name.insert(record.name.clone(), by_name.len());
+            true
+        }).collect();
+        Ok(TwoBitFile { path: path.to_string(), data, layout, records, by_name })
+    }
+
+    pub fn records(&self) -> &[TwoBitRecord] {
+        &self.records
+    }
+
+    /// The record of the sequence called `name`.
+    pub fn get(&self, name: &str) -> Option<&TwoBitRecord> {
+        self.by_name.get(name).map(|&index| &self.records[index])
+    }
+
+    /// Reads the sequences called `names` into one arena, in that order.
+    pub fn load<'a>(&self, names: impl IntoIterator<Item = &'a str>) -> Result<Genome, Error> {
+        let mut genome = Genome::new();
+        for name in names {
+            let record = self.get(name)
+                .ok_or_else(|| Error::new(ErrorKind::NotFound, format!("No sequence '{}' in '{}'", name, self.path)))?;
+            read_record(&self.data, self.layout, record, &mut genome)
+                .map_err(|e| Error::new(e.kind(), format!("Error reading '{}' from '{}': {}", name, self.path, e)))?;
+        }
+        Ok(genome.finish())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// A version 0 `.2bit` file holding `sequences`, with N blocks and lowercase mask blocks.
+    fn encode(sequences: &[(&str, &[u8])], big_endian: bool) -> Vec<u8> {
+        let word = |value: u32| if big_endian { value.to_be_bytes() } else { value.to_le_bytes() };
+        let blocks = |seq: &[u8], pred: fn(&u8) -> bool| {
+            let mut blocks: Vec<(u32, u32)> = Vec::new();
+            for (pos, base) in seq.iter().enumerate() {
+                match blocks.last_mut() {
+                    Some((start, size)) if pred(base) && (*start + *size) as usize == pos => *size += 1,
+                    _ if pred(base) => blocks.push((pos as u32, 1)),
+                    _ => {}
+                }
+            }
+            blocks
+        };
+        let mut records = Vec::new();
+        for (_, seq) in sequences {
+            let mut record = word(seq.len() as u32).to_vec();
+            for pred in [(|base: &u8| base.eq_ignore_ascii_case(&b'N')) as fn(&u8) -> bool, |base: &u8| base.is_ascii_lowercase()] {
+                let blocks = blocks(seq, pred);
+                record.extend_from_slice(&word(blocks.len() as u32));
+                blocks.iter().for_each(|&(start, _)| record.extend_from_slice(&word(start)));
+                blocks.iter().for_each(|&(_, size)| record.extend_from_slice(&word(size)));
+            }
+            record.extend_from_slice(&word(0));
+            for group in seq.chunks(4) {
+                let mut byte = 0u8;
+                for (slot, base) in group.iter().enumerate() {
+                    let code = match base.to_ascii_uppercase() { b'C' => 1, b'A' => 2, b'G' => 3, _ => 0 };
+                    byte |= code << (6 - 2 * slot);
+                }
+                record.push(byte);
+            }
+            records.push(record);
+        }
+        let mut out = Vec::new();
+        for value in [SIGNATURE, 0, sequences.len() as u32, 0] {
+            out.extend_from_slice(&word(value));
+        }
+        let mut offset = 16 + sequences.iter().map(|(name, _)| 5 + name.len()).sum::<usize>();
+        for ((name, _), record) in sequences.iter().zip(&records) {
+            out.push(name.len() as u8);
+            out.extend_from_slice(name.as_bytes());
+            out.extend_from_slice(&word(offset as u32));
+            offset += record.len();
+        }
+        records.iter().for_each(|record| out.extend_from_slice(record));
+        out
+    }
+
+    #[test]
+    fn test_read_2bit() {
+        let long: Vec<u8> = (0..100_000u32).map(|i| b"ACGTacgtNNGA"[(i * 7 % 12) as usize]).collect();
+        let sequences: [(&str, &[u8]); 3] = [("chr1", b"ACGTNNNNacgtTTG"), ("chrM", b"G"), ("long", &long)];
+        for big_endian in [false, true] {
+            let data = encode(&sequences, big_endian);
+            let (layout, records) = read_index(&data).unwrap();
+            assert_eq!(records.iter().map(|record| record.len).collect::<Vec<_>>(), vec![15, 1, 100_000]);
+            // The later sequences only, as a wave would load them.
+            let mut genome = Genome::new();
+            for record in &records[1..] {
+                read_record(&data, layout, record, &mut genome).unwrap();
+            }
+            let mut expected = Genome::new();
+            for (name, seq) in &sequences[1..] {
+                expected.begin_contig(name.to_string());
+                expected.push_bases(seq);
+            }
+            let (sequence, contigs) = genome.finish().into_parts();
+            let (expected_sequence, expected_contigs) = expected.finish().into_parts();
+            assert_eq!(contigs, expected_contigs);
+            assert_eq!(sequence, expected_sequence);
+
+            let mut first = Genome::new();
+            read_record(&data, layout, &records[0], &mut first).unwrap();
+            let (sequence, _) = first.finish().into_parts();
+            assert_eq!(sequence.to_ascii(0..15), b"ACGTNNNNACGTTTG");
+        }
+        assert!(read_index(b"ACGT\n").is_err());
+        assert!(read_index(&encode(&sequences, false)[..30]).is_err());
+    }
+}
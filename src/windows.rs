@@ -0,0 +1,121 @@
+//! Per-tier window storage.
+//!
+//! A tier-0 row reads 10 bytes out of every grid spacing of the chromosome, so
+//! almost all of every cache line it fetches is wasted. `TierWindows` unpacks
+//! the short windows of one tier back to back before any pair is computed, so
+//! the near-tier kernels of a tile read consecutive bytes and a tier's working
+//! set is as small as its windows. Far-tier windows tile the whole grid, so
+//! `PackedWindows` keeps them in the 2-bit genome store and unpacks them only
+//! for the DP.
+
+use crate::packed::PackedSequence;
+use std::sync::Arc;
+
+/// The `window_len`-bp window of every grid point, unpacked back to back.
+pub struct TierWindows {
+    data: Vec<u8>,
+    window_len: usize,
+}
+
+impl TierWindows {
+    /// Windows of the contig starting at base `offset` of `sequence`.
+    pub fn new(sequence: &PackedSequence, offset: usize, num_grid_points: usize, grid_spacing: usize, window_len: usize) -> Self {
+        let mut data = Vec::with_capacity(num_grid_points * window_len);
+        let mut window = Vec::with_capacity(window_len);
+        for idx in 0..num_grid_points {
+            let start = offset + idx * grid_spacing;
+            sequence.unpack_into(start..start + window_len, &mut window);
+            data.extend_from_slice(&window);
+        }
+        TierWindows { data, window_len }
+    }
+
+    #[inline]
+    pub fn window(&self, idx: usize) -> &[u8] {
+        let start = idx * self.window_len;
+        &self.data[start..start + self.window_len]
+    }
+
+    /// `window` for kernels specialized on the window length.
+    #[inline]
+    pub fn fixed_window<const N: usize>(&self, idx: usize) -> &[u8; N] {
+        self.window(idx).try_into().expect("window length matches N")
+    }
+
+    pub fn window_len(&self) -> usize {
+        self.window_len
+    }
+
+    /// The buffer holding all windows, `window_len` bytes apart.
+    pub fn data(&self) -> &[u8] {
+        &self.data
+    }
+}
+
+/// The `window_len`-bp window of every grid point, read from the packed
+/// genome arena shared by all contigs.
+pub struct PackedWindows {
+    sequence: Arc<PackedSequence>,
+    /// Arena position of the contig's first base.
+    offset: usize,
+    grid_spacing: usize,
+    window_len: usize,
+}
+
+impl PackedWindows {
+    pub fn new(sequence: Arc<PackedSequence>, offset: usize, grid_spacing: usize, window_len: usize) -> Self {
+        PackedWindows { sequence, offset, grid_spacing, window_len }
+    }
+
+    #[inline]
+    fn start(&self, idx: usize) -> usize {
+        self.offset + idx * self.grid_spacing
+    }
+
+    /// Replaces the contents of `out` with the ASCII bases of a window.
+    pub fn unpack_into(&self, idx: usize, out: &mut Vec<u8>) {
+        let start = self.start(idx);
+        self.sequence.unpack_into(start..start + self.window_len, out);
+    }
+
+    /// Bases other than `N` among the first `len` of a window.
+    pub fn non_n_bases(&self, idx: usize, len: usize) -> usize {
+        let start = self.start(idx);
+        len - self.sequence.count_n(start..start + len)
+    }
+
+    /// Mismatching positions between two windows, on the packed words.
+    pub fn hamming(&self, idx1: usize, idx2: usize) -> usize {
+        self.sequence.hamming(self.start(idx1), self.start(idx2), self.window_len)
+    }
+
+    /// Deduplication key of a window, or `None` when it is all `N`.
+    pub fn class_key(&self, idx: usize) -> Option<Vec<u64>> {
+        let range = self.start(idx)..self.start(idx) + self.window_len;
+        (!self.sequence.is_all_n(range.clone())).then(|| self.sequence.range_key(range))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_tier_windows() {
+        // The contig starts 3 bases into the arena.
+        let sequence = Arc::new(PackedSequence::from_ascii(b"GGGACGTTTGGCCAANNNN"));
+        let near = TierWindows::new(&sequence, 3, 4, 4, 2);
+        assert_eq!(near.data(), b"ACTTCCNN");
+        assert_eq!(near.window(2), b"CC");
+        assert_eq!(near.fixed_window::<2>(3), b"NN");
+
+        let far = PackedWindows::new(sequence, 3, 4, 4);
+        let mut window = Vec::new();
+        far.unpack_into(1, &mut window);
+        assert_eq!(window, b"TTGG");
+        assert_eq!(far.non_n_bases(3, 4), 0);
+        assert_eq!(far.hamming(0, 1), 3);
+        assert!(far.class_key(3).is_none());
+        assert!(far.class_key(2).is_some());
+    }
+}